@@ -39,6 +39,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <opt-A2.h>
 #include <opt-A3.h>
 #include <addrspace.h>
 #include <proc.h>
@@ -201,8 +202,21 @@ mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		/* Time up to now was spent in user mode. */
+		if (!iskern) {
+			thread_usage_charge(true);
+#if OPT_A2
+			proc_checkcpulimit(curproc);
+#endif
+		}
+
 		mainbus_interrupt(tf);
 
+		/* And the interrupt itself was system time. */
+		if (!iskern) {
+			thread_usage_charge(false);
+		}
+
 		if (doadjust) {
 			KASSERT(curthread->t_curspl == IPL_HIGH);
 			KASSERT(curthread->t_iplhigh_count == 1);
@@ -211,6 +225,15 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+#if OPT_A2
+		if (!iskern &&
+		    (curproc->p_exiting || curproc->p_cpuexceeded)) {
+			/* Sync the interrupt state as below; see done. */
+			spl = splhigh();
+			splx(spl);
+			goto done;
+		}
+#endif
 		goto done2;
 	}
 
@@ -228,15 +251,21 @@ mips_trap(struct trapframe *tf)
 	spl = splhigh();
 	splx(spl);
 
+	/* Charge the time since we left the kernel to user mode. */
+	if (!iskern) {
+		thread_usage_charge(true);
+#if OPT_A2
+		proc_checkcpulimit(curproc);
+#endif
+	}
+
 	/* Syscall? Call the syscall handler and return. */
 	if (code == EX_SYS) {
 		/* Interrupts should have been on while in user mode. */
 		KASSERT(curthread->t_curspl == 0);
 		KASSERT(curthread->t_iplhigh_count == 0);
 
-		DEBUG(DB_SYSCALL, "syscall: #%d, args %x %x %x %x\n", 
-		      tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
-
+		/* (syscall() traces the call, by name) */
 		syscall(tf);
 		goto done;
 	}
@@ -249,17 +278,17 @@ mips_trap(struct trapframe *tf)
 	switch (code) {
 	case EX_MOD:
 		if (vm_fault(VM_FAULT_READONLY, tf->tf_vaddr)==0) {
-			goto done;
+			goto fault_done;
 		}
 		break;
 	case EX_TLBL:
 		if (vm_fault(VM_FAULT_READ, tf->tf_vaddr)==0) {
-			goto done;
+			goto fault_done;
 		}
 		break;
 	case EX_TLBS:
 		if (vm_fault(VM_FAULT_WRITE, tf->tf_vaddr)==0) {
-			goto done;
+			goto fault_done;
 		}
 		break;
 	case EX_IBE:
@@ -330,7 +359,25 @@ mips_trap(struct trapframe *tf)
 
 	panic("I can't handle this... I think I'll just die now...\n");
 
+ fault_done:
+	/* A handled fault from user mode; count it. */
+	if (!iskern) {
+		thread_usage_count(1, 0, 0);
+	}
  done:
+#if OPT_A2
+	/*
+	 * Going back to user mode. If another thread in the process
+	 * has called _exit (or exec), go away instead.
+	 */
+	if (!iskern) {
+		uthread_checkexit();
+	}
+#endif
+	/* Charge the time in the kernel as system time. */
+	if (!iskern) {
+		thread_usage_charge(false);
+	}
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -391,6 +438,7 @@ mips_usermode(struct trapframe *tf)
 	 * above, we explicitly call spl0() and then call cpu_irqoff().
 	 */
 	spl0();
+	thread_usage_charge(false);
 	cpu_irqoff();
 
 	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
@@ -31,13 +31,611 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <cpu.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
 #include <addrspace.h>
+#include <copyinout.h>
 
 #include "opt-A2.h"
+
+/*
+ * The system call table.
+ *
+ * syscalltab is indexed by call number. Each entry has the call's
+ * name, how many of the argument registers it takes (for tracing),
+ * and a stub that pulls the arguments out of the trapframe, casts
+ * them to what the real handler expects, and calls it. Call numbers
+ * with no entry get ENOSYS.
+ *
+ * To add a system call, write its sc_ stub and add it to the table.
+ */
+
+/* Call numbers are all below this. */
+#define SYSCALL_MAX		128
+
+struct syscallent {
+	const char *se_name;
+	unsigned se_nargs;
+	int (*se_func)(struct trapframe *tf, int32_t *retval);
+};
+
+/*
+ * Statistics.
+ *
+ * Each cpu counts the calls made on it and keeps a histogram of how
+ * long they took, so the counting needs no locks; sysstat adds the
+ * cpus up. Bucket 0 is under 1 microsecond, and bucket B (B > 0) is
+ * 2^(B-1) up to 2^B microseconds; the last bucket takes everything
+ * longer. Calls that don't return (_exit) are counted but not timed.
+ */
+
+#define SYSCALL_NBUCKETS	16
+
+struct syscallstat {
+	uint32_t ss_calls;
+	uint64_t ss_nsecs;
+	uint32_t ss_hist[SYSCALL_NBUCKETS];
+};
+
+/* One array of SYSCALL_MAX per cpu, indexed by cpu number. */
+static struct syscallstat *syscallstats[CPUMASK_MAXCPUS];
+
+////////////////////////////////////////////////////////////
+// Argument marshalling stubs
+
+static
+int
+sc_reboot(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_reboot(tf->tf_a0);
+}
+
+static
+int
+sc___time(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_nanosleep(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_nanosleep((const_userptr_t)tf->tf_a0,
+			     (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_futex(struct trapframe *tf, int32_t *retval)
+{
+	return sys_futex((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+			 (int)tf->tf_a2, retval);
+}
+
+static
+int
+sc_open(struct trapframe *tf, int32_t *retval)
+{
+	return sys_open((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+			(mode_t)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc_close(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_close((int)tf->tf_a0);
+}
+
+static
+int
+sc_read(struct trapframe *tf, int32_t *retval)
+{
+	return sys_read((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			(unsigned)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc_write(struct trapframe *tf, int32_t *retval)
+{
+	return sys_write((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (unsigned)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc_readv(struct trapframe *tf, int32_t *retval)
+{
+	return sys_readv((int)tf->tf_a0, (const_userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc_writev(struct trapframe *tf, int32_t *retval)
+{
+	return sys_writev((int)tf->tf_a0, (const_userptr_t)tf->tf_a1,
+			  (int)tf->tf_a2, (int *)retval);
+}
+
+/*
+ * pread/pwrite(int fd, void *buf, size_t len, off_t pos): a3 is
+ * skipped, because POS is 64 bits and has to be aligned; that puts
+ * it on the user stack.
+ */
+static
+int
+sc_pread(struct trapframe *tf, int32_t *retval)
+{
+	off_t pos;
+	int result;
+
+	result = copyin((const_userptr_t)(tf->tf_sp + 16), &pos, sizeof(pos));
+	if (result) {
+		return result;
+	}
+	return sys_pread((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (size_t)tf->tf_a2, pos, (int *)retval);
+}
+
+static
+int
+sc_pwrite(struct trapframe *tf, int32_t *retval)
+{
+	off_t pos;
+	int result;
+
+	result = copyin((const_userptr_t)(tf->tf_sp + 16), &pos, sizeof(pos));
+	if (result) {
+		return result;
+	}
+	return sys_pwrite((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			  (size_t)tf->tf_a2, pos, (int *)retval);
+}
+
+/*
+ * lseek(int fd, off_t pos, int whence): POS is 64 bits, so it goes
+ * in the aligned pair a2/a3 (high word first; we're big-endian), and
+ * WHENCE ends up on the user stack. The result is 64 bits too, and
+ * goes back in v0/v1.
+ */
+static
+int
+sc_lseek(struct trapframe *tf, int32_t *retval)
+{
+	off_t pos, newpos;
+	int whence;
+	int result;
+
+	pos = ((off_t)tf->tf_a2 << 32) | (uint32_t)tf->tf_a3;
+	result = copyin((const_userptr_t)(tf->tf_sp + 16), &whence,
+			sizeof(whence));
+	if (result) {
+		return result;
+	}
+	result = sys_lseek((int)tf->tf_a0, pos, whence, &newpos);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)(newpos >> 32);
+	tf->tf_v1 = (uint32_t)newpos;
+	return 0;
+}
+
+static
+int
+sc_dup2(struct trapframe *tf, int32_t *retval)
+{
+	return sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, (int *)retval);
+}
+
+static
+int
+sc_fstat(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_fstat((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+#ifdef UW
+
+static
+int
+sc__exit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	sys__exit((int)tf->tf_a0);
+	/* sys__exit does not return, execution should not get here */
+	panic("unexpected return from sys__exit");
+	return 0;
+}
+
+static
+int
+sc_getpid(struct trapframe *tf, int32_t *retval)
+{
+	(void)tf;
+	return sys_getpid((pid_t *)retval);
+}
+
+static
+int
+sc_waitpid(struct trapframe *tf, int32_t *retval)
+{
+	return sys_waitpid((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2, (pid_t *)retval);
+}
+
+static
+int
+sc_wait4(struct trapframe *tf, int32_t *retval)
+{
+	return sys_wait4((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2, (userptr_t)tf->tf_a3,
+			 (pid_t *)retval);
+}
+
+static
+int
+sc_getrusage(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+#endif // UW
+
+#if OPT_A2
+static
+int
+sc_fork(struct trapframe *tf, int32_t *retval)
+{
+	return sys_fork(tf, (pid_t *)retval);
+}
+
+static
+int
+sc_vfork(struct trapframe *tf, int32_t *retval)
+{
+	return sys_vfork(tf, (pid_t *)retval);
+}
+
+static
+int
+sc_execv(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_spawn(struct trapframe *tf, int32_t *retval)
+{
+	return sys_spawn((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (pid_t *)retval);
+}
+
+static
+int
+sc_thread_create(struct trapframe *tf, int32_t *retval)
+{
+	return sys_thread_create(tf, (userptr_t)tf->tf_a0,
+				 (userptr_t)tf->tf_a1,
+				 (userptr_t)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc_thread_join(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_thread_join((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_thread_exit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	sys_thread_exit((int)tf->tf_a0);
+	panic("unexpected return from sys_thread_exit");
+	return 0;
+}
+
+static
+int
+sc_getpriority(struct trapframe *tf, int32_t *retval)
+{
+	return sys_getpriority((int)tf->tf_a0, (pid_t)tf->tf_a1,
+			       (int *)retval);
+}
+
+static
+int
+sc_setpriority(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_setpriority((int)tf->tf_a0, (pid_t)tf->tf_a1,
+			       (int)tf->tf_a2);
+}
+
+static
+int
+sc_getrlimit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_getrlimit((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_setrlimit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_setrlimit((int)tf->tf_a0, (const_userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_sched_setaffinity(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_sched_setaffinity((pid_t)tf->tf_a0, (size_t)tf->tf_a1,
+				     (const_userptr_t)tf->tf_a2);
+}
+
+static
+int
+sc_pset_bind(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_pset_bind((unsigned)tf->tf_a0, (pid_t)tf->tf_a1);
+}
+#endif //OPT_A2
+
+#define SYSCALL(name, nargs) \
+	[SYS_##name] = { #name, nargs, sc_##name }
+
+static const struct syscallent syscalltab[SYSCALL_MAX] = {
+	SYSCALL(reboot, 1),
+	SYSCALL(__time, 2),
+	SYSCALL(nanosleep, 2),
+	SYSCALL(futex, 3),
+	SYSCALL(open, 3),
+	SYSCALL(close, 1),
+	SYSCALL(read, 3),
+	SYSCALL(write, 3),
+	SYSCALL(readv, 3),
+	SYSCALL(writev, 3),
+	SYSCALL(pread, 3),
+	SYSCALL(pwrite, 3),
+	SYSCALL(lseek, 4),
+	SYSCALL(dup2, 2),
+	SYSCALL(fstat, 2),
+#ifdef UW
+	SYSCALL(_exit, 1),
+	SYSCALL(getpid, 0),
+	SYSCALL(waitpid, 3),
+	SYSCALL(wait4, 4),
+	SYSCALL(getrusage, 2),
+#endif // UW
+#if OPT_A2
+	SYSCALL(fork, 0),
+	SYSCALL(vfork, 0),
+	SYSCALL(execv, 2),
+	SYSCALL(spawn, 2),
+	SYSCALL(thread_create, 3),
+	SYSCALL(thread_join, 2),
+	SYSCALL(thread_exit, 1),
+	SYSCALL(getpriority, 2),
+	SYSCALL(setpriority, 3),
+	SYSCALL(getrlimit, 2),
+	SYSCALL(setrlimit, 2),
+	SYSCALL(sched_setaffinity, 3),
+	SYSCALL(pset_bind, 2),
+#endif //OPT_A2
+};
+
+////////////////////////////////////////////////////////////
+// Statistics
+
+/*
+ * Set up the statistics for a new cpu. Called from cpu_create.
+ */
+int
+syscall_cpuinit(unsigned cpunum)
+{
+	KASSERT(cpunum < CPUMASK_MAXCPUS);
+	KASSERT(syscallstats[cpunum] == NULL);
+
+	syscallstats[cpunum] = kmalloc(SYSCALL_MAX *
+				       sizeof(struct syscallstat));
+	if (syscallstats[cpunum] == NULL) {
+		return ENOMEM;
+	}
+	bzero(syscallstats[cpunum], SYSCALL_MAX * sizeof(struct syscallstat));
+	return 0;
+}
+
+static
+uint64_t
+syscall_gettime(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime_fast(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+static
+unsigned
+syscall_bucket(uint64_t nsecs)
+{
+	uint64_t usecs;
+	unsigned b;
+
+	usecs = nsecs / 1000;
+	for (b = 0; usecs > 0 && b < SYSCALL_NBUCKETS - 1; b++) {
+		usecs >>= 1;
+	}
+	return b;
+}
+
+/*
+ * Count a call, and record how long one took, on the current cpu.
+ * (A thread that sleeps in a call may finish it on another cpu.)
+ * Interrupts are off so we can't be moved in the middle.
+ */
+static
+void
+syscall_count(int callno)
+{
+	int spl;
+
+	spl = splhigh();
+	syscallstats[curcpu->c_number][callno].ss_calls++;
+	splx(spl);
+}
+
+static
+void
+syscall_time(int callno, uint64_t nsecs)
+{
+	struct syscallstat *ss;
+	int spl;
+
+	spl = splhigh();
+	ss = &syscallstats[curcpu->c_number][callno];
+	ss->ss_nsecs += nsecs;
+	ss->ss_hist[syscall_bucket(nsecs)]++;
+	splx(spl);
+}
+
+/*
+ * Bucket upper bound, in microseconds, under which PCT percent of
+ * SS's timed calls fell.
+ */
+static
+unsigned
+syscall_percentile(const struct syscallstat *ss, unsigned pct)
+{
+	uint32_t total, sofar;
+	unsigned b;
+
+	total = 0;
+	for (b = 0; b < SYSCALL_NBUCKETS; b++) {
+		total += ss->ss_hist[b];
+	}
+	sofar = 0;
+	for (b = 0; b < SYSCALL_NBUCKETS - 1; b++) {
+		sofar += ss->ss_hist[b];
+		if ((uint64_t)sofar * 100 >= (uint64_t)total * pct) {
+			break;
+		}
+	}
+	return 1U << b;
+}
+
+/*
+ * Print the MAX system calls that have taken the most time in all,
+ * across all cpus. The per-cpu counters are read without stopping
+ * anyone, so the numbers may be a little off if calls are going on.
+ */
+void
+syscall_printstats(unsigned max)
+{
+	struct syscallstat *sum, *ss;
+	unsigned *top;
+	unsigned num, i, j, c, b, callno;
+
+	if (max == 0) {
+		return;
+	}
+	sum = kmalloc(SYSCALL_MAX * sizeof(*sum));
+	top = kmalloc(max * sizeof(*top));
+	if (sum == NULL || top == NULL) {
+		kfree(sum);
+		kfree(top);
+		kprintf("sysstat: Out of memory\n");
+		return;
+	}
+	bzero(sum, SYSCALL_MAX * sizeof(*sum));
+
+	for (c = 0; c < CPUMASK_MAXCPUS; c++) {
+		if (syscallstats[c] == NULL) {
+			continue;
+		}
+		for (i = 0; i < SYSCALL_MAX; i++) {
+			ss = &syscallstats[c][i];
+			sum[i].ss_calls += ss->ss_calls;
+			sum[i].ss_nsecs += ss->ss_nsecs;
+			for (b = 0; b < SYSCALL_NBUCKETS; b++) {
+				sum[i].ss_hist[b] += ss->ss_hist[b];
+			}
+		}
+	}
+
+	/* Keep TOP sorted by total time, longest first. */
+	num = 0;
+	for (callno = 0; callno < SYSCALL_MAX; callno++) {
+		if (sum[callno].ss_calls == 0) {
+			continue;
+		}
+		if (num == max &&
+		    sum[callno].ss_nsecs <= sum[top[max-1]].ss_nsecs) {
+			continue;
+		}
+		j = (num < max) ? num++ : max-1;
+		while (j > 0 &&
+		       sum[top[j-1]].ss_nsecs < sum[callno].ss_nsecs) {
+			top[j] = top[j-1];
+			j--;
+		}
+		top[j] = callno;
+	}
+
+	kprintf("%-14s %10s %12s %10s %10s %10s\n", "call", "calls",
+		"total(us)", "avg(us)", "p50(us)<", "p99(us)<");
+	for (i = 0; i < num; i++) {
+		ss = &sum[top[i]];
+		kprintf("%-14s %10u %12llu %10llu %10u %10u\n",
+			syscalltab[top[i]].se_name, ss->ss_calls,
+			ss->ss_nsecs / 1000,
+			ss->ss_nsecs / 1000 / ss->ss_calls,
+			syscall_percentile(ss, 50),
+			syscall_percentile(ss, 99));
+	}
+	kfree(top);
+	kfree(sum);
+}
+
+void
+syscall_resetstats(void)
+{
+	unsigned c;
+
+	for (c = 0; c < CPUMASK_MAXCPUS; c++) {
+		if (syscallstats[c] != NULL) {
+			bzero(syscallstats[c],
+			      SYSCALL_MAX * sizeof(struct syscallstat));
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * System call dispatcher.
  *
@@ -79,9 +677,11 @@
 void
 syscall(struct trapframe *tf)
 {
+	const struct syscallent *se;
 	int callno;
 	int32_t retval;
 	int err;
+	uint64_t start, end;
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -100,54 +700,43 @@ syscall(struct trapframe *tf)
 
 	retval = 0;
 
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS___time:
-		err = sys___time((userptr_t)tf->tf_a0,
-				 (userptr_t)tf->tf_a1);
-		break;
-#ifdef UW
-	case SYS_write:
-	  err = sys_write((int)tf->tf_a0,
-			  (userptr_t)tf->tf_a1,
-			  (int)tf->tf_a2,
-			  (int *)(&retval));
-	  break;
-	case SYS__exit:
-	  sys__exit((int)tf->tf_a0);
-	  /* sys__exit does not return, execution should not get here */
-	  panic("unexpected return from sys__exit");
-	  break;
-	case SYS_getpid:
-	  err = sys_getpid((pid_t *)&retval);
-	  break;
-	case SYS_waitpid:
-	  err = sys_waitpid((pid_t)tf->tf_a0,
-			    (userptr_t)tf->tf_a1,
-			    (int)tf->tf_a2,
-			    (pid_t *)&retval);
-	  break;
-#endif // UW
-
-	    /* Add stuff here */
-#if OPT_A2
-	case SYS_fork:
-	  err = sys_fork(tf, &retval);
-	  break;
-	case SYS_execv:
-	  err = sys_execv((userptr_t) tf->tf_a0, (userptr_t) tf->tf_a1);
-	  break;
-#endif //OPT_A2
-
-	default:
-	  kprintf("Unknown syscall %d\n", callno);
-	  err = ENOSYS;
-	  break;
+	if (callno < 0 || callno >= SYSCALL_MAX ||
+	    syscalltab[callno].se_func == NULL) {
+		kprintf("Unknown syscall %d\n", callno);
+		err = ENOSYS;
 	}
+	else {
+		se = &syscalltab[callno];
+		switch (se->se_nargs) {
+		    case 0:
+			DEBUG(DB_SYSCALL, "syscall: %s()\n", se->se_name);
+			break;
+		    case 1:
+			DEBUG(DB_SYSCALL, "syscall: %s(%x)\n", se->se_name,
+			      tf->tf_a0);
+			break;
+		    case 2:
+			DEBUG(DB_SYSCALL, "syscall: %s(%x, %x)\n",
+			      se->se_name, tf->tf_a0, tf->tf_a1);
+			break;
+		    case 3:
+			DEBUG(DB_SYSCALL, "syscall: %s(%x, %x, %x)\n",
+			      se->se_name, tf->tf_a0, tf->tf_a1, tf->tf_a2);
+			break;
+		    default:
+			DEBUG(DB_SYSCALL, "syscall: %s(%x, %x, %x, %x)\n",
+			      se->se_name, tf->tf_a0, tf->tf_a1, tf->tf_a2,
+			      tf->tf_a3);
+			break;
+		}
 
+		syscall_count(callno);
+		start = syscall_gettime();
+		err = se->se_func(tf, &retval);
+		end = syscall_gettime();
+		/* cpus' clocks may disagree if we moved; count that as 0 */
+		syscall_time(callno, end > start ? end - start : 0);
+	}
 
 	if (err) {
 		/*
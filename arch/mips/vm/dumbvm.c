@@ -38,6 +38,7 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <opt-A3.h>
+#include <opt-A2.h>
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
  * enough to struggle off the ground.
@@ -501,6 +502,15 @@ as_prepare_load(struct addrspace *as)
 	KASSERT(as->as_pbase2 == 0);
 	KASSERT(as->as_stackpbase == 0);
 
+#if OPT_A2
+	/* Don't let the loading process go over its address space limit. */
+	if (curproc != NULL &&
+	    (rlim_t)(as->as_npages1 + as->as_npages2 + DUMBVM_STACKPAGES)
+	    * PAGE_SIZE > proc_getrlimit(curproc, RLIMIT_AS)) {
+		return ENOMEM;
+	}
+#endif
+
 	as->as_pbase1 = getppages(as->as_npages1);
 	if (as->as_pbase1 == 0) {
 		return ENOMEM;
@@ -50,6 +50,13 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/*
+ * Timer count used to switch the on-chip timer "off". There's no way
+ * to disable it; this is as long as it goes (about 170 seconds at
+ * 25 MHz) and if it does go off, clockintr() is harmless.
+ */
+#define MIPS_TIMER_OFF 0xffffffff
+
 /*
  * Access to the on-chip timer.
  *
@@ -73,6 +80,34 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * The cycle counter, c0_count, which also drives the on-chip timer.
+ */
+uint32_t
+mainbus_cycles(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count; see mips_timer_set */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+#if 1000000000 % CPU_FREQUENCY != 0
+#error "mainbus_cycles_to_nsecs assumes a whole number of ns per cycle"
+#endif
+
+uint64_t
+mainbus_cycles_to_nsecs(uint32_t cycles)
+{
+	return (uint64_t)cycles * (1000000000 / CPU_FREQUENCY);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -116,6 +151,20 @@ mainbus_bootstrap(void)
 	mips_timer_set(CPU_FREQUENCY / HZ);
 }
 
+/*
+ * Set the on-chip timer for the clock code. Interrupts should be off.
+ */
+void
+mainbus_timer_set(uint32_t usecs)
+{
+	if (usecs == 0 || usecs >= MIPS_TIMER_OFF / (CPU_FREQUENCY / 1000000)) {
+		mips_timer_set(MIPS_TIMER_OFF);
+	}
+	else {
+		mips_timer_set(usecs * (CPU_FREQUENCY / 1000000));
+	}
+}
+
 /*
  * Start all secondary CPUs.
  */
@@ -268,10 +317,11 @@ mainbus_interrupt(struct trapframe *tf)
 		lamebus_clear_ipi(lamebus, curcpu);
 	}
 	else if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
-		hardclock();
+		/*
+		 * Call the clock code, which resets the timer (this
+		 * clears the interrupt) and calls hardclock if needed.
+		 */
+		clockintr();
 	}
 	else {
 		panic("Unknown interrupt; cause register is %08x\n", cause);
@@ -91,10 +91,18 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 		havetimerclock = true;
 		lt->lt_timerclock = 1;
 
+#if OPT_TICKLESS
+		/*
+		 * Leave it off. Timed sleeps use timeouts, and the
+		 * scheduler ages cpu usage from schedule() instead.
+		 */
+		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 0);
+#else
 		/* Wire it to go off once every second. */
 		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
 		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
 				   LT_GRANULARITY);
+#endif
 	}
 	
 	return 0;
@@ -31,6 +31,7 @@
 #define _CLOCK_H_
 
 #include "opt-synchprobs.h"
+#include "opt-tickless.h"
 
 /*
  * Time-related definitions.
@@ -38,16 +39,33 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU once a second, for periodic
+ * housekeeping. For timed operations use timeouts (<timeout.h>).
+ *
+ * clockintr() is called by the platform code when a CPU's timer goes
+ * off; it runs any timeouts that are due and calls hardclock() when
+ * one is due.
  *
  * gettime() may be used to fetch the current time of day.
+ * gettime_fast() fetches it from the current cpu's cycle counter,
+ * which is much cheaper than reading the clock device; it's for the
+ * clock interrupt, the scheduler, and cpu time accounting. It's
+ * caught up with the real clock once a second, and never goes
+ * backwards on any one cpu, though different cpus may disagree
+ * slightly. It turns interrupts off briefly.
  * getinterval() computes the time from time1 to time2.
  *
  * XXX we have struct timespec now, let's use it.
  */
 
-/* hardclocks per second */
+/*
+ * hardclocks per second
+ *
+ * This can be overridden from the compiler command line. With
+ * options tickless idle cpus don't take timer interrupts at all, so
+ * a higher value is cheaper than it would otherwise be.
+ */
+#ifndef HZ
 #if OPT_SYNCHPROBS
 /* Make synchronization more exciting :) */
 #define HZ  10000
@@ -55,13 +73,26 @@
 /* More realistic value */
 #define HZ  100
 #endif
+#endif
 
-void hardclock_bootstrap(void);
-
+void clockintr(void);
 void hardclock(void);
 void timerclock(void);
 
+/*
+ * Start or stop the hardclock timer on the current cpu. Both are
+ * cheap if the timer is already in the requested state. Interrupts
+ * must be off; hardclock_stop must also be called with the current
+ * cpu's run queue lock held, so nobody can queue a thread between
+ * our deciding the timer isn't needed and turning it off.
+ *
+ * Without options tickless, hardclock_stop does nothing.
+ */
+void hardclock_start(void);
+void hardclock_stop(void);
+
 void gettime(time_t *seconds, uint32_t *nanoseconds);
+void gettime_fast(time_t *seconds, uint32_t *nanoseconds);
 
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
@@ -69,7 +100,8 @@ void getinterval(time_t secs1, uint32_t nsecs,
 
 /*
  * clocksleep() suspends execution for the requested number of seconds,
- * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * like userlevel sleep(3). (Don't confuse it with wchan_sleep.) For
+ * finer-grained sleeps use thread_sleep_until().
  */
 void clocksleep(int seconds);
 
@@ -33,6 +33,7 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <timeout.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
@@ -59,7 +60,32 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadpool;	/* Exited threads for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	struct thread *c_evicted;	/* Thread to move to another cpu */
+	struct thread *c_evictor;	/* Runs while c_evicted leaves */
+
+	/*
+	 * Written only by this cpu, with the runqueue lock held when
+	 * cleared; other cpus read it to decide if they need to send
+	 * IPI_UNIDLE to get the timer going again.
+	 */
+	bool c_ticking;			/* True if hardclock timer is on */
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 */
+	uint64_t c_nexthardclock;	/* Timeout tick of next hardclock */
+	uint64_t c_nextclockintr;	/* Tick the timer is set for */
+	time_t c_clocksecs;		/* Last gettime_fast() result */
+	uint32_t c_clocknsecs;
+	uint32_t c_clockcycles;		/* Cycle count it was taken at */
+
+	/*
+	 * Pending timeouts. Accessed by other cpus (to cancel them).
+	 * Protected by the wheel's own lock.
+	 */
+	struct timeoutwheel c_timeouts;
 
 	/*
 	 * Accessed by other cpus.
@@ -69,6 +95,12 @@ struct cpu {
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus.
+	 * Lock-free: other cpus push, this cpu takes everything.
+	 */
+	struct thread *volatile c_inbox; /* Threads woken by other cpus */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -161,7 +193,9 @@ void cpu_halt(void);
 #define IPI_PANIC		0	/* System has called panic() */
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
+					/* (also restarts hardclock) */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_QSBR		4	/* Grace period started; see qsbr.h */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and file tables.
+ *
+ * An openfile is what open() makes: a vnode, the access mode it was
+ * opened with, and a seek position. It's refcounted, because file
+ * tables share it after fork and dup2; the offset is shared too, as
+ * it should be.
+ *
+ * A filetable maps a process's file descriptors to openfiles. All
+ * the threads of a process share it. Changes to it are made under
+ * ft_lock, but filetable_get, on the path of every read and write,
+ * takes no lock: it reads the slot in a QSBR read section (see
+ * qsbr.h) and takes a reference only if the openfile isn't already
+ * on its way out. The last decref closes the vnode at once but frees
+ * the openfile itself only after a grace period.
+ *
+ * openfile_open	Open PATH (which is destroyed) with FLAGS and MODE.
+ * openfile_incref	Add a reference.
+ * openfile_decref	Drop a reference; the last one closes the file.
+ *
+ * filetable_create	Make an empty table.
+ * filetable_copy	Make a table sharing all the same openfiles.
+ * filetable_destroy	Drop all the openfiles and free the table.
+ * filetable_place	Put OF at the lowest free descriptor below MAX.
+ *			The table takes over the caller's reference.
+ * filetable_get	Look up FD. The caller gets a new reference.
+ * filetable_replace	Put OF (with a new reference) at FD, handing
+ *			back what was there (or NULL) to be decref'd.
+ * filetable_remove	Take FD out, handing back its openfile to be
+ *			decref'd.
+ */
+
+#include <limits.h>
+#include <spinlock.h>
+#include <qsbr.h>
+
+struct lock;
+struct vnode;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_accmode;			/* O_RDONLY, O_WRONLY, or O_RDWR */
+	bool of_append;			/* O_APPEND */
+
+	struct lock *of_lock;		/* held across I/O, for: */
+	off_t of_offset;		/* current seek position */
+
+	struct spinlock of_countlock;	/* protects of_refcount */
+	unsigned of_refcount;
+
+	struct qsbr_head of_qh;		/* for freeing after the last ref */
+};
+
+struct filetable {
+	struct spinlock ft_lock;	/* protects ft_files */
+	struct openfile *volatile ft_files[OPEN_MAX];
+};
+
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+struct filetable *filetable_create(void);
+int filetable_copy(struct filetable *src, struct filetable **ret);
+void filetable_destroy(struct filetable *ft);
+int filetable_place(struct filetable *ft, struct openfile *of, unsigned max,
+		    int *fd);
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_replace(struct filetable *ft, int fd, struct openfile *of,
+		      struct openfile **oldret);
+int filetable_remove(struct filetable *ft, int fd, struct openfile **ret);
+
+
+#endif /* _FILE_H_ */
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics (options lockstat).
+ *
+ * Spinlocks, locks and CVs carry a struct lockstat when the option is
+ * on. Ones that have been given a name with lockstat_register are
+ * profiled: how often they're acquired (for CVs, waited on), how
+ * often that meant waiting, the total time spent spinning or
+ * sleeping for them, and the longest time one was held. Times come
+ * from the ltimer's clock via gettime(), so nothing is timed until
+ * lockstat_bootstrap is called once the clock is attached.
+ *
+ * Locks and CVs are registered under their lk_name/cv_name when
+ * created; the spinlocks inside locks, semaphores and rwlocks are
+ * registered under the owning object's name, and each cpu's run
+ * queue lock as "runqueue". Other spinlocks aren't profiled.
+ *
+ * The counters are only updated by whoever holds the lock (for a CV,
+ * the lock that goes with it), so they need no locking of their own.
+ */
+
+#include "opt-lockstat.h"
+
+#define LOCKSTAT_SPIN	0	/* Spinlock */
+#define LOCKSTAT_LOCK	1	/* Sleep lock */
+#define LOCKSTAT_CV	2	/* Condition variable */
+
+struct lockstat {
+	const char *ls_name;		/* Name, or NULL if not profiled */
+	unsigned ls_kind;		/* LOCKSTAT_* */
+	unsigned ls_acquires;		/* Times acquired/waited on */
+	unsigned ls_contended;		/* Times that meant waiting */
+	uint64_t ls_waitnsecs;		/* Total time spent waiting */
+	uint64_t ls_maxhold;		/* Longest hold, in nsecs */
+	uint64_t ls_holdstart;		/* When the holder got it */
+	struct lockstat *ls_next;	/* Link on list of all of them */
+	struct lockstat **ls_prevp;
+};
+
+#define LOCKSTAT_INITIALIZER	{ NULL, 0, 0, 0, 0, 0, 0, NULL, NULL }
+
+/*
+ * Setup and registration.
+ *
+ * lockstat_bootstrap  - start timing; called from boot() once the
+ *                       clock is attached.
+ * lockstat_init       - initialize an unnamed (not profiled) record.
+ * lockstat_register   - start profiling LS under NAME, which must
+ *                       outlive the registration.
+ * lockstat_unregister - stop profiling LS. Safe if never registered.
+ */
+void lockstat_bootstrap(void);
+void lockstat_init(struct lockstat *ls);
+void lockstat_register(struct lockstat *ls, const char *name,
+		       unsigned kind);
+void lockstat_unregister(struct lockstat *ls);
+
+/*
+ * Hooks for the lock code.
+ *
+ * lockstat_now       - current time if LS is profiled, otherwise 0.
+ *                      Called when the caller first finds it has to
+ *                      wait; pass the result to the next call.
+ * lockstat_acquired  - LS was just acquired, having waited since
+ *                      WAITSTART if that's nonzero.
+ * lockstat_released  - LS is about to be released.
+ * lockstat_waited    - a CV wait that began at WAITSTART is over.
+ */
+uint64_t lockstat_now(const struct lockstat *ls);
+void lockstat_acquired(struct lockstat *ls, uint64_t waitstart);
+void lockstat_released(struct lockstat *ls);
+void lockstat_waited(struct lockstat *ls, uint64_t waitstart);
+
+/*
+ * Reporting; for the lockstat menu command.
+ *
+ * lockstat_print - print the MAX records with the most time waited.
+ * lockstat_reset - zero all the counters.
+ */
+void lockstat_print(unsigned max);
+void lockstat_reset(void);
+
+
+#endif /* _LOCKSTAT_H_ */
@@ -55,6 +55,22 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Set the current cpu's timer to go off once, USECS microseconds from
+ * now, replacing any previous setting; 0 turns it off. clockintr() is
+ * called when it goes off. This is for the clock code's use only.
+ */
+void mainbus_timer_set(uint32_t usecs);
+
+/*
+ * Read the current cpu's cycle counter, and convert a number of
+ * cycles to nanoseconds. The counter wraps (in a few minutes), so
+ * only differences over short intervals mean anything, and counters
+ * on different cpus aren't related. For gettime_fast().
+ */
+uint32_t mainbus_cycles(void);
+uint64_t mainbus_cycles_to_nsecs(uint32_t cycles);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
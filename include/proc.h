@@ -41,11 +41,15 @@
 #include <thread.h> /* required for struct threadarray */
 
 #include <types.h>
+#include <kern/time.h>
+#include <kern/resource.h>	/* for struct rlimit */
 #include <array.h>
 #include <synch.h>
 
 struct addrspace;
 struct vnode;
+struct filetable;
+struct uthread;
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -61,10 +65,8 @@ DEFARRAY(proc, PROCINLINE);
 
 #if OPT_A2
 	int curpid;
-	struct array* proctable;
-	struct array *recycletable;
-	struct cv *wait_cv;
-	struct lock* proctable_lock;
+	struct array *recycletable;	/* dead nodes, for reuse */
+	struct rwlock* proctable_lock;
 #endif  // OPT_A2
 
 /*
@@ -80,38 +82,63 @@ struct proc {
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
+	struct filetable *p_filetable;	/* open files; see file.h */
 
-#ifdef UW
-  /* a vnode to refer to the console device */
-  /* this is a quick-and-dirty way to get console writes working */
-  /* you will probably need to change this when implementing file-related
-     system calls, since each process will need to keep track of all files
-     it has opened, not just the console. */
-  struct vnode *console;                /* a vnode for the console device */
-#endif
+	/* Resource usage, protected by p_lock */
+	struct usage p_usage;		/* threads that have left */
+	struct usage p_cusage;		/* children that have been reaped */
 
 	/* add more material here as needed */
 #if OPT_A2
 	pid_t pid;
+	struct semaphore *p_vforksem;	/* vfork parent waits here; while
+					   set, p_addrspace is borrowed */
+
+	/* User threads; see proc_syscalls.c */
+	struct lock *p_uthreadlock;	/* protects the rest of these */
+	struct cv *p_uthreadcv;		/* thread exits announced here */
+	struct uthread *p_uthreads;	/* threads from thread_create */
+	int p_nexttid;			/* next thread id to hand out */
+	unsigned p_nthreads;		/* live user threads */
+	volatile bool p_exiting;	/* threads must leave (_exit/exec) */
+
+	/* Resource limits, protected by p_lock; inherited by children */
+	struct rlimit p_rlimit[__RLIMIT_NUM];
+	volatile bool p_cpuexceeded;	/* over RLIMIT_CPU; must die */
 #endif //OPT_A2
 
 };
 
 struct node {
-//	struct proc* nproc;
+	struct proc* nproc;	/* NULL once the process has exited */
 	pid_t pid;
 	pid_t parent;
 	int status;    // 1-proc is running
                        // 2-proc exited but not deleted yet
                        // 0-proc exited
 	int exitcode;
+	struct node *children;	/* our children, linked by sibling */
+	struct node *sibling;	/* next child of our parent */
+	struct lock *waitlock;	/* for waitcv */
+	struct cv *waitcv;	/* we wait here for children to exit */
+	struct usage ru;	/* ours and our children's, once exited */
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
 #if OPT_A2
-int get_node(pid_t pid);
+/*
+ * The proctable maps pids to nodes; see proc.c. Call these with
+ * proctable_lock held, for writing in the case of the last two.
+ *
+ * get_node returns NULL if there's no such pid. node_addchild
+ * records a parent/child pair. node_reap takes a node out of the
+ * table and its parent's child list and recycles its pid.
+ */
+struct node *get_node(pid_t pid);
+void node_addchild(struct node *parent, struct node *child);
+void node_reap(struct node *n);
 #endif //OPT_A2
 
 /* Semaphore used to signal when there are no more processes */
@@ -134,6 +161,17 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Resource usage of a process (RUSAGE_SELF) or its reaped children. */
+int proc_getusage(struct proc *proc, int who, struct usage *u);
+
+#if OPT_A2
+/* Fetch a process's soft limit for RESOURCE (an RLIMIT_* code). */
+rlim_t proc_getrlimit(struct proc *proc, int resource);
+
+/* From traps and the scheduler: mark PROC to die if over RLIMIT_CPU. */
+void proc_checkcpulimit(struct proc *proc);
+#endif //OPT_A2
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
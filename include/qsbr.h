@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _QSBR_H_
+#define _QSBR_H_
+
+/*
+ * Quiescent-state-based reclamation (QSBR).
+ *
+ * This lets hot lookups read a shared pointer without taking the lock
+ * that protects it. Readers bracket the lookup with qsbr_read_begin
+ * and qsbr_read_end, which only raise and restore the spl; nothing is
+ * written to shared memory. A writer unhooks the old object and then
+ * either waits with qsbr_synchronize, or queues a callback with
+ * qsbr_call, until every cpu has passed through a quiescent state.
+ * Only then is the old object released.
+ *
+ * A cpu is quiescent whenever it is not inside a read section. Since
+ * read sections run with interrupts off and may not sleep or yield,
+ * a cpu reports a quiescent state on every context switch in
+ * thread_switch, when it goes idle, on each hardclock, and on
+ * IPI_QSBR. The cpu starting a grace period sends IPI_QSBR to the
+ * others so that a cpu running one thread with its timer off
+ * (options tickless) doesn't hold things up.
+ *
+ * Callbacks run on whichever cpu ends the grace period, from
+ * interrupt or thread_switch context, and so must not sleep; kfree
+ * is fine, VOP_DECREF is not. Use qsbr_synchronize for those.
+ *
+ * Functions:
+ *     qsbr_bootstrap      - set up at boot; called from boot().
+ *     qsbr_cpu_online     - make the current cpu take part.
+ *     qsbr_read_begin     - start a read section; returns old spl.
+ *     qsbr_read_end       - end a read section.
+ *     qsbr_call           - run FUNC(ARG) after a grace period. QH
+ *                           is caller-provided storage (usually
+ *                           embedded in the object being freed).
+ *     qsbr_synchronize    - sleep until a full grace period passes
+ *                           and the callbacks queued before it have
+ *                           run.
+ *     qsbr_quiescent      - report a quiescent state for this cpu.
+ */
+
+#include <cdefs.h>
+#include <spl.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef QSBR_INLINE
+#define QSBR_INLINE INLINE
+#endif
+
+struct qsbr_head {
+	struct qsbr_head *qh_next;	/* Link on the pending list */
+	unsigned qh_gp;			/* Grace period to wait for */
+	void (*qh_func)(void *);	/* What to call */
+	void *qh_arg;			/* Argument to pass */
+};
+
+void qsbr_bootstrap(void);
+void qsbr_cpu_online(void);
+
+int qsbr_read_begin(void);
+void qsbr_read_end(int spl);
+
+void qsbr_call(struct qsbr_head *qh, void (*func)(void *), void *arg);
+void qsbr_synchronize(void);
+
+void qsbr_quiescent(void);
+
+////////////////////////////////////////////////////////////
+
+QSBR_INLINE
+int
+qsbr_read_begin(void)
+{
+	return splhigh();
+}
+
+QSBR_INLINE
+void
+qsbr_read_end(int spl)
+{
+	splx(spl);
+}
+
+
+#endif /* _QSBR_H_ */
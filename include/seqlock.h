@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+/*
+ * Sequence locks.
+ *
+ * A seqlock protects a small record that is read much more often
+ * than it is written. Writers serialize on a spinlock and bump the
+ * sequence number before and after changing the record, so it is odd
+ * while a write is in progress. Readers take no lock and write no
+ * shared memory: they sample the sequence number, copy the record
+ * out, and retry if the number was odd or has changed since.
+ *
+ *    do {
+ *        seq = seqlock_read_begin(&sl);
+ *        copy = record;
+ *    } while (seqlock_read_retry(&sl, seq));
+ *
+ * Because a reader may see a torn copy (which it then throws away),
+ * the record must not contain pointers the reader follows before
+ * seqlock_read_retry says the copy is good.
+ *
+ * init		Initialize the contents of a seqlock.
+ * cleanup	Opposite of init. No writer may be active.
+ *
+ * write_begin	Lock out other writers and start a change.
+ * write_end	Finish the change and let readers and writers in.
+ *
+ * read_begin	Start a read; returns the sequence number to check.
+ * read_retry	True if the copy taken since read_begin may be torn.
+ */
+
+#include <cdefs.h>
+#include <spinlock.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef SEQLOCK_INLINE
+#define SEQLOCK_INLINE INLINE
+#endif
+
+struct seqlock {
+	struct spinlock sl_lock;	/* Serializes writers */
+	volatile unsigned sl_seq;	/* Odd while a write is underway */
+};
+
+#define SEQLOCK_INITIALIZER	{ SPINLOCK_INITIALIZER, 0 }
+
+/*
+ * Keep the compiler from moving loads and stores across the sequence
+ * number updates. The hardware we run on doesn't reorder memory
+ * accesses, so this is all the ordering that's needed.
+ */
+#define SEQLOCK_BARRIER()	__asm volatile("" ::: "memory")
+
+void seqlock_init(struct seqlock *sl);
+void seqlock_cleanup(struct seqlock *sl);
+
+void seqlock_write_begin(struct seqlock *sl);
+void seqlock_write_end(struct seqlock *sl);
+
+unsigned seqlock_read_begin(const struct seqlock *sl);
+bool seqlock_read_retry(const struct seqlock *sl, unsigned seq);
+
+////////////////////////////////////////////////////////////
+
+SEQLOCK_INLINE
+void
+seqlock_init(struct seqlock *sl)
+{
+	spinlock_init(&sl->sl_lock);
+	sl->sl_seq = 0;
+}
+
+SEQLOCK_INLINE
+void
+seqlock_cleanup(struct seqlock *sl)
+{
+	KASSERT((sl->sl_seq & 1) == 0);
+	spinlock_cleanup(&sl->sl_lock);
+}
+
+SEQLOCK_INLINE
+void
+seqlock_write_begin(struct seqlock *sl)
+{
+	spinlock_acquire(&sl->sl_lock);
+	sl->sl_seq++;
+	SEQLOCK_BARRIER();
+}
+
+SEQLOCK_INLINE
+void
+seqlock_write_end(struct seqlock *sl)
+{
+	SEQLOCK_BARRIER();
+	sl->sl_seq++;
+	spinlock_release(&sl->sl_lock);
+}
+
+SEQLOCK_INLINE
+unsigned
+seqlock_read_begin(const struct seqlock *sl)
+{
+	unsigned seq;
+
+	while ((seq = sl->sl_seq) & 1) {
+		/* A writer is in the middle; wait for it */
+	}
+	SEQLOCK_BARRIER();
+	return seq;
+}
+
+SEQLOCK_INLINE
+bool
+seqlock_read_retry(const struct seqlock *sl, unsigned seq)
+{
+	SEQLOCK_BARRIER();
+	return sl->sl_seq != seq;
+}
+
+
+#endif /* _SEQLOCK_H_ */
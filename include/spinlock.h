@@ -45,6 +45,8 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+#include <lockstat.h>
+
 /*
  * Basic spinlock.
  *
@@ -57,12 +59,20 @@
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	struct lockstat lk_stat;	/* Contention statistics. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, NULL, LOCKSTAT_INITIALIZER }
+#else
 #define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
 
 /*
  * Spinlock functions.
@@ -84,5 +94,16 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+/*
+ * Profile the spinlock under NAME (options lockstat; see lockstat.h).
+ * spinlock_cleanup stops profiling it again.
+ */
+#if OPT_LOCKSTAT
+#define spinlock_setname(lk, name) \
+	lockstat_register(&(lk)->lk_stat, (name), LOCKSTAT_SPIN)
+#else
+#define spinlock_setname(lk, name) ((void)(lk), (void)(name))
+#endif
+
 
 #endif /* _SPINLOCK_H_ */
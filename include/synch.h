@@ -78,6 +78,12 @@ struct lock {
         struct spinlock lk_lock;
         struct thread *lk_thread;
         volatile int lk_count;
+        unsigned lk_waiters;    /* threads asleep on lk_wchan */
+        struct thread *lk_piwaiters;    /* same, for priority inheritance */
+        struct lock *lk_heldnext;       /* next lock held by lk_thread */
+#if OPT_LOCKSTAT
+        struct lockstat lk_stat;        /* contention statistics */
+#endif
         // add what you need here
         // (don't forget to mark things volatile as needed)
 };
@@ -88,7 +94,11 @@ void lock_acquire(struct lock *);
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. If the holder is running on another cpu
+ *                   we spin for a little while, since it'll probably let
+ *                   go soon, before going to sleep. While we sleep the
+ *                   holder (and whoever it's waiting for, and so on)
+ *                   runs at our priority if that's better than its own.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
@@ -119,6 +129,9 @@ struct cv {
         char *cv_name;
         // add what you need here
         struct wchan *cv_wchan;
+#if OPT_LOCKSTAT
+        struct lockstat cv_stat;        /* time spent waiting */
+#endif
         // (don't forget to mark things volatile as needed)
 };
 
@@ -143,4 +156,47 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * too, so a stream of readers can't starve writers out.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+
+struct rwlock {
+        char *rw_name;
+        struct spinlock rw_lock;
+        struct wchan *rw_rwchan;        /* readers wait here */
+        struct wchan *rw_wwchan;        /* writers wait here */
+        unsigned rw_readers;            /* readers holding the lock */
+        unsigned rw_waitwriters;        /* writers waiting for it */
+        struct thread *rw_writer;       /* writer holding it, or NULL */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Give up a write hold.
+ *    rwlock_downgrade     - Turn a write hold into a read hold, without
+ *                           letting any other writer in between.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+void rwlock_downgrade(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
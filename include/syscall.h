@@ -33,6 +33,8 @@
 #include "opt-A2.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct usage; /* from <thread.h> */
+struct addrspace; /* from <addrspace.h> */
 
 /*
  * The system call dispatcher.
@@ -40,6 +42,14 @@ struct trapframe; /* from <machine/trapframe.h> */
 
 void syscall(struct trapframe *tf);
 
+/*
+ * Per-call statistics: set up for a new cpu (from cpu_create), print
+ * the MAX calls with the most total time, and zero the counters.
+ */
+int syscall_cpuinit(unsigned cpunum);
+void syscall_printstats(unsigned max);
+void syscall_resetstats(void);
+
 /*
  * Support functions.
  */
@@ -58,18 +68,56 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
+int sys_futex(userptr_t uaddr, int op, int val, int32_t *retval);
 
-#ifdef UW
+/* Set up the futex hash table. */
+void futex_bootstrap(void);
+/* Wake all futex waiters in AS, as their process is exiting. */
+void futex_interrupt(struct addrspace *as);
+
+int sys_open(userptr_t path, int flags, mode_t mode, int *retval);
+int sys_close(int fd);
+int sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval);
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_pread(int fd, userptr_t ubuf, size_t nbytes, off_t pos, int *retval);
+int sys_pwrite(int fd, userptr_t ubuf, size_t nbytes, off_t pos, int *retval);
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_fstat(int fd, userptr_t statbuf);
+
+#ifdef UW
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
+int sys_wait4(pid_t pid, userptr_t status, int options, userptr_t rusage,
+	      pid_t *retval);
+int sys_getrusage(int who, userptr_t usage);
 
 #endif // UW
 
 #if OPT_A2
+/* The guts of waitpid/wait4, for use in the kernel too. */
+int proc_wait(pid_t pid, int *exitstatus, struct usage *ru);
 int sys_fork(struct trapframe *tf, pid_t* retval);
 int sys_execv(userptr_t progname, userptr_t args);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
+int sys_spawn(userptr_t progname, userptr_t args, pid_t *retval);
+int sys_thread_create(struct trapframe *tf, userptr_t entry, userptr_t stack,
+		      userptr_t arg, int *retval);
+int sys_thread_join(int tid, userptr_t status);
+void sys_thread_exit(int status);
+
+/* On the way back to user mode: leave if the process is exiting. */
+void uthread_checkexit(void);
+int sys_getpriority(int which, pid_t who, int *retval);
+int sys_setpriority(int which, pid_t who, int prio);
+int sys_getrlimit(int resource, userptr_t rlp);
+int sys_setrlimit(int resource, const_userptr_t rlp);
+int sys_sched_setaffinity(pid_t pid, size_t size, const_userptr_t mask);
+int sys_pset_bind(unsigned pset, pid_t pid);
 #endif //OPT_A2
 
 
@@ -59,9 +59,14 @@ int queuetest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int rwtest2(int, char **);
+int qsbrtest(int, char **);
+int pitest(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -70,6 +75,11 @@ int uwlocktest1(int, char **);
 int uwvmstatstest(int, char **);
 #endif
 
+#if OPT_A2
+/* process tests */
+int waittest(int, char **);
+#endif
+
 /* filesystem tests */
 int fstest(int, char **);
 int readstress(int, char **);
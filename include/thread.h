@@ -38,9 +38,35 @@
 
 #include <array.h>
 #include <spinlock.h>
+#include <seqlock.h>
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
+struct timespec;
+
+/*
+ * Sets of cpus, one bit per cpu number. This limits us to 32 cpus,
+ * which is also as many as System/161 supports.
+ */
+typedef uint32_t cpumask_t;
+#define CPUMASK_MAXCPUS		32
+#define CPUMASK_ALL		((cpumask_t)0xffffffff)
+#define CPUMASK_BIT(n)		((cpumask_t)1 << (n))
+
+/*
+ * Resource usage of a thread, or summed over a process. See
+ * thread_usage_charge; getrusage reports this.
+ */
+struct usage {
+	uint64_t u_utime;		/* nsecs in user mode */
+	uint64_t u_stime;		/* nsecs in the kernel */
+	uint32_t u_minflt;		/* page faults */
+	uint32_t u_nvcsw;		/* voluntary context switches */
+	uint32_t u_nivcsw;		/* involuntary context switches */
+	uint64_t u_inbytes;		/* bytes read */
+	uint64_t u_outbytes;		/* bytes written */
+};
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -82,6 +108,8 @@ struct thread {
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
+	struct cpu *t_prevcpu;		/* CPU it was last stolen from */
+	struct thread *t_inboxnext;	/* Link for cpu's c_inbox */
 	struct proc *t_proc;		/* Process thread belongs to */
 
 	/*
@@ -101,6 +129,46 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields.
+	 *
+	 * t_priority is recomputed from t_nice and t_cpuusage by the
+	 * scheduler; lower values run first. t_cpuusage counts the
+	 * hardclocks charged to the thread and is halved once a
+	 * second (lazily, using t_schedepoch) so threads that sleep a
+	 * lot, such as the menu or anything reading the console, end
+	 * up ahead of CPU-bound threads.
+	 *
+	 * t_inheritpri is the best priority lent to the thread by
+	 * threads sleeping on locks it holds (THREAD_PRI_MAX if none);
+	 * t_priority is never worse than that. The lock fields are
+	 * for this priority inheritance; see synch.c.
+	 */
+	int t_nice;			/* Base priority (PRIO_MIN..PRIO_MAX) */
+	int t_priority;			/* Current (effective) priority */
+	int t_inheritpri;		/* Priority lent by lock waiters */
+	struct lock *t_blockedon;	/* Lock we're asleep on */
+	struct thread *t_piwaitnext;	/* Next waiter on t_blockedon */
+	struct lock *t_heldlocks;	/* Locks we hold */
+	unsigned t_cpuusage;		/* Recent cpu usage, in hardclocks */
+	unsigned t_schedepoch;		/* Value of sched epoch at last decay */
+
+	/*
+	 * CPU placement. The thread may only run on cpus that are
+	 * both in t_affinity and in processor set t_pset.
+	 */
+	cpumask_t t_affinity;		/* CPUs the thread may run on */
+	unsigned t_pset;		/* Processor set it is bound to */
+
+	/*
+	 * Resource accounting. Only the thread itself updates
+	 * t_usage; t_usagelock lets others read it consistently.
+	 * t_usagestamp is when time was last charged.
+	 */
+	struct usage t_usage;		/* What we've used so far */
+	struct seqlock t_usagelock;	/* For reading t_usage */
+	uint64_t t_usagestamp;		/* Time of last charge (nsecs) */
+
 	/*
 	 * Public fields
 	 */
@@ -157,16 +225,101 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Sleep until the time of day reaches WHEN (see gettime()). Returns
+ * at once if it already has. Resolution is 1/TIMEOUT_HZ seconds.
+ */
+void thread_sleep_until(const struct timespec *when);
+
+/*
+ * Scheduling priorities. Lower numbers are better. A thread with
+ * nice value 0 and no recent cpu usage runs at THREAD_PRI_DEFAULT;
+ * each SCHED_USAGE_PER_PRI hardclocks of recent cpu usage push it
+ * down one priority.
+ */
+#define THREAD_PRI_MIN		0
+#define THREAD_PRI_MAX		63
+#define THREAD_PRI_DEFAULT	24
+#define SCHED_USAGE_PER_PRI	4
+#define SCHED_USAGE_MAX		255
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Age cpu usage estimates. Called once a second from timerclock(),
+ * and, with options tickless, from schedule().
+ */
+void schedcpu(void);
+
+/*
+ * Get or set the nice value (PRIO_MIN..PRIO_MAX) of a thread. Values
+ * out of range are clamped. The new value takes effect the next
+ * time the thread is queued.
  */
-void thread_consider_migration(void);
+int thread_getnice(struct thread *t);
+void thread_setnice(struct thread *t, int nice);
+
+/*
+ * Resource accounting.
+ *
+ * thread_usage_charge charges the time since the last charge to the
+ * current thread, as user time if USER, else system time. It's
+ * called on every trap from and return to user mode, and around
+ * context switches (so time spent switched out isn't charged).
+ * thread_usage_count adds page faults and I/O bytes.
+ * thread_getusage takes a consistent copy of T's usage; usage_add
+ * adds one usage record to another.
+ */
+void thread_usage_charge(bool user);
+void thread_usage_count(unsigned faults, size_t inbytes, size_t outbytes);
+void thread_getusage(struct thread *t, struct usage *u);
+void usage_add(struct usage *to, const struct usage *from);
+
+/*
+ * Set the priority T inherits from lock waiters (see synch.c) and
+ * make it take effect at once, moving T in its run queue if it's
+ * queued. Call with the priority inheritance lock held.
+ */
+void thread_setinheritpri(struct thread *t, int pri);
+
+/*
+ * CPU affinity and processor sets.
+ *
+ * Every cpu belongs to exactly one of PSET_MAX processor sets. They
+ * all start out in PSET_DEFAULT, which must always keep at least
+ * one. Moving cpus into another set dedicates them to the threads
+ * bound to that set: those threads run only there, and nobody else
+ * does. A thread also has an affinity mask and runs only on cpus in
+ * both. New threads inherit the affinity and set of their parent.
+ *
+ * A thread that finds itself on a cpu it isn't allowed on (because
+ * something changed) is moved off at its next context switch. If a
+ * set loses all its cpus, its threads run in the default set.
+ *
+ * User processes get at these with sched_setaffinity and pset_bind,
+ * for themselves and their children.
+ *
+ * Functions:
+ *     thread_setaffinity - set T's affinity mask. EINVAL if T could
+ *                          then run nowhere in its set.
+ *     thread_setpset     - bind T to set PSET. EINVAL if the set is
+ *                          empty, or T could run nowhere in it.
+ *     pset_assign        - move cpu CPUNUM to set PSET. EBUSY if that
+ *                          would empty the default set.
+ *     pset_getcpus       - return the cpus in set PSET.
+ */
+#define PSET_DEFAULT	0
+#define PSET_MAX	8
+
+int thread_setaffinity(struct thread *t, cpumask_t mask);
+cpumask_t thread_getaffinity(struct thread *t);
+int thread_setpset(struct thread *t, unsigned pset);
+unsigned thread_getpset(struct thread *t);
+int pset_assign(unsigned pset, unsigned cpunum);
+cpumask_t pset_getcpus(unsigned pset);
 
 
 #endif /* _THREAD_H_ */
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TIMEOUT_H_
+#define _TIMEOUT_H_
+
+/*
+ * Timeouts: call a function at a given time in the future.
+ *
+ * Each cpu has a hierarchical timer wheel of pending timeouts. A
+ * timeout is placed on the wheel of the cpu that sets it, and the
+ * callback runs on that cpu, from the timer interrupt. The callback
+ * is therefore run in interrupt context with interrupts off and may
+ * not sleep; typically it just wakes somebody up.
+ *
+ * Timeouts have a resolution of TIMEOUT_HZ ticks per second,
+ * independent of HZ, and a deadline is never reported early.
+ *
+ * The struct timeout is owned by the caller, which must not free it
+ * while it is pending. Setting and cancelling a given timeout must
+ * be serialized by the caller.
+ *
+ * Functions:
+ *     timeout_init   - prepare a timeout to call FUNC(DATA).
+ *     timeout_set    - arm the timeout to go off at time of day WHEN
+ *                      (as returned by gettime()), replacing any
+ *                      previous setting. Returns false, without
+ *                      arming it, if WHEN has already passed.
+ *     timeout_cancel - disarm the timeout. Returns true if it was
+ *                      pending. If it returns false the callback may
+ *                      still be running on another cpu.
+ */
+
+#include <spinlock.h>
+
+struct timespec;
+
+#define TIMEOUT_HZ		10000	/* ticks per second (100 us) */
+#define TIMEOUT_NEVER		((uint64_t)-1)
+
+#define TIMEOUT_WHEEL_BITS	6
+#define TIMEOUT_WHEEL_SLOTS	(1 << TIMEOUT_WHEEL_BITS)
+#define TIMEOUT_WHEEL_LEVELS	4
+
+struct timeoutwheel;
+
+struct timeout {
+	struct timeout *to_next;	/* next in wheel slot */
+	struct timeout **to_prevp;	/* pointer that points to us */
+	struct timeoutwheel *to_wheel;	/* wheel we're on, or NULL */
+	unsigned to_level;		/* wheel level we're on */
+	uint64_t to_tick;		/* when we go off */
+	void (*to_func)(void *);	/* what to call */
+	void *to_data;			/* and its argument */
+};
+
+/*
+ * The wheel itself. Level N has TIMEOUT_WHEEL_SLOTS slots, each
+ * covering TIMEOUT_WHEEL_SLOTS^N ticks; timeouts trickle down a
+ * level (cascade) as their slot comes up. Timeouts more than
+ * TIMEOUT_WHEEL_SLOTS^TIMEOUT_WHEEL_LEVELS ticks (about half an
+ * hour) out are parked in the farthest slot and re-examined when
+ * it comes up.
+ */
+struct timeoutwheel {
+	struct spinlock tw_lock;	/* lock for this wheel */
+	uint64_t tw_now;		/* last tick processed */
+	unsigned tw_count[TIMEOUT_WHEEL_LEVELS];
+	struct timeout *tw_slots[TIMEOUT_WHEEL_LEVELS][TIMEOUT_WHEEL_SLOTS];
+};
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *data);
+bool timeout_set(struct timeout *to, const struct timespec *when);
+bool timeout_cancel(struct timeout *to);
+
+/* Called from cpu_create. */
+void timeoutwheel_init(struct timeoutwheel *tw);
+
+#endif /* _TIMEOUT_H_ */
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Work queues: run a function later, in a kernel thread.
+ *
+ * Each cpu has a queue of pending work items and a small pool of
+ * worker threads bound to it, at most WORKQ_MAXWORKERS. A cpu starts
+ * with one worker; a worker that takes an item while more are
+ * waiting and nobody else is idle starts another, so thread creation
+ * is paid for once rather than per task. Idle workers sleep on a wait
+ * channel.
+ *
+ * An item runs on the cpu that queued it (for delayed items, the cpu
+ * the delay was set on). Items may be queued from interrupt handlers
+ * and timeout callbacks; the function itself runs in thread context
+ * and may sleep. It may requeue its own item.
+ *
+ * The struct work is owned by the caller, which must not free it
+ * while it is queued. Queueing and cancelling a given item must be
+ * serialized by the caller.
+ *
+ * Functions:
+ *     workqueue_bootstrap - start the workers; called from boot().
+ *     work_init           - prepare WK to call FUNC(DATA1, DATA2).
+ *     work_queue          - queue WK to run soon. Returns false if
+ *                           it was already queued or delayed.
+ *     work_queue_delayed  - queue WK to run once DELAY has passed.
+ *                           Returns false if it was already queued.
+ *     work_cancel         - unqueue WK. Returns true if it was still
+ *                           waiting; if false, it may be running.
+ */
+
+#include <spinlock.h>
+#include <timeout.h>
+
+struct timespec;
+struct workq;
+
+#define WORKQ_MAXWORKERS	4
+
+/* Item states */
+#define WORK_IDLE	0	/* Not queued (may be running) */
+#define WORK_DELAYED	1	/* Waiting for its timeout */
+#define WORK_QUEUED	2	/* On a queue, waiting for a worker */
+
+struct work {
+	struct work *wk_next;		/* Next on queue */
+	struct workq *wk_wq;		/* Queue we're (going) on */
+	unsigned wk_state;		/* WORK_* */
+	struct timeout wk_timeout;	/* For work_queue_delayed */
+	void (*wk_func)(void *, unsigned long);	/* What to call */
+	void *wk_data1;			/* ...and its arguments */
+	unsigned long wk_data2;
+};
+
+void workqueue_bootstrap(void);
+
+void work_init(struct work *wk, void (*func)(void *, unsigned long),
+	       void *data1, unsigned long data2);
+bool work_queue(struct work *wk);
+bool work_queue_delayed(struct work *wk, const struct timespec *delay);
+bool work_cancel(struct work *wk);
+
+
+#endif /* _WORKQUEUE_H_ */
@@ -120,6 +120,42 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         return ENOSPC;
 }
 
+/*
+ * Like bitmap_alloc, but start looking at bit START, wrapping around
+ * at the end. With a cursor that follows the last allocation this
+ * hands bits out round-robin, and skipping full words keeps it cheap
+ * unless the bitmap is nearly full.
+ */
+int
+bitmap_alloc_from(struct bitmap *b, unsigned start, unsigned *index)
+{
+        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+        unsigned ix, n, offset;
+
+        KASSERT(start < b->nbits);
+        ix = start / BITS_PER_WORD;
+        offset = start % BITS_PER_WORD;
+
+        /* maxix+1 words, so the bits before START get looked at too */
+        for (n=0; n<=maxix; n++) {
+                if (b->v[ix]!=WORD_ALLBITS) {
+                        for (; offset < BITS_PER_WORD; offset++) {
+                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
+
+                                if ((b->v[ix] & mask)==0) {
+                                        b->v[ix] |= mask;
+                                        *index = (ix*BITS_PER_WORD)+offset;
+                                        KASSERT(*index < b->nbits);
+                                        return 0;
+                                }
+                        }
+                }
+                offset = 0;
+                ix = (ix + 1) % maxix;
+        }
+        return ENOSPC;
+}
+
 static
 inline
 void
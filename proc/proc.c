@@ -43,13 +43,25 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <bitmap.h>
+#include <file.h>
 #include <kern/fcntl.h>  
+#include <kern/unistd.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <cpu.h>
+#include <clock.h>
+#include <spl.h>
+#include <thread.h>
+#include <timeout.h>
 
 
 #include "opt-A2.h"
@@ -73,24 +85,158 @@ struct semaphore *no_proc_sem;
 
 #if OPT_A2
 //	int curpid;
-	static pid_t pid_count;
+/*
+ * Pid allocation. pidmap has a bit set for each pid in use (and for
+ * the ones below PID_MIN, which are never handed out). pid_next
+ * follows the last pid handed out, so pids are used round-robin: a
+ * freed pid isn't reused until all the others have been tried,
+ * which keeps a stale pid (in a waitpid or kill racing with an exit)
+ * from naming a new process any time soon.
+ */
+	static struct bitmap *pidmap;
+	static unsigned pid_next;
 #endif //OPT_A2
 
 #if OPT_A2
-int get_node(pid_t pid){
-  int num = array_num(proctable);
-  int index = -1;
-
-  for(int i=0; i<num; i++){
-    struct node* cur = array_get(proctable, i);
-    if(pid == cur->pid){
-      index=i;
-      break;
+/*
+ * The proctable: a two-level radix tree indexed by pid. The top
+ * level is indexed by the high bits of the pid and points to leaves
+ * of PIDTABLE_LEAFSIZE node pointers. Leaves are allocated as pids
+ * get used and never freed, since the pids get reused.
+ */
+#define PIDTABLE_LEAFBITS  8
+#define PIDTABLE_LEAFSIZE  (1 << PIDTABLE_LEAFBITS)
+#define PIDTABLE_NLEAVES   ((PID_MAX >> PIDTABLE_LEAFBITS) + 1)
+
+static struct node **proctable[PIDTABLE_NLEAVES];
+
+struct node *get_node(pid_t pid){
+  struct node **leaf;
+
+  if(pid < 0 || pid > PID_MAX){
+    return NULL;
+  }
+  leaf = proctable[pid >> PIDTABLE_LEAFBITS];
+  if(leaf == NULL){
+    return NULL;
+  }
+  return leaf[pid & (PIDTABLE_LEAFSIZE - 1)];
+}
+
+static
+int
+proctable_add(struct node *n){
+  struct node **leaf;
+
+  KASSERT(get_node(n->pid) == NULL);
+  if(n->pid < 0 || n->pid > PID_MAX){
+    return ENPROC;
+  }
+  leaf = proctable[n->pid >> PIDTABLE_LEAFBITS];
+  if(leaf == NULL){
+    leaf = kmalloc(PIDTABLE_LEAFSIZE * sizeof(struct node *));
+    if(leaf == NULL){
+      return ENOMEM;
     }
+    for(int i=0; i<PIDTABLE_LEAFSIZE; i++){
+      leaf[i] = NULL;
+    }
+    proctable[n->pid >> PIDTABLE_LEAFBITS] = leaf;
   }
-  KASSERT(index>=0);
-  return index;
-}	
+  leaf[n->pid & (PIDTABLE_LEAFSIZE - 1)] = n;
+  return 0;
+}
+
+/*
+ * Per-cpu timeout that makes sure a cpu running a process with a
+ * cpu time limit gets interrupted by the time the limit might run
+ * out, even if nothing else would interrupt it (running tickless, a
+ * lone cpu-bound thread may not otherwise trap at all). The callback
+ * just notes that it went off: the interrupt itself, taken from user
+ * mode, gets the running process checked again. Only touched on its
+ * own cpu with interrupts off.
+ */
+struct cpulimit {
+	struct timeout cl_timeout;
+	bool cl_armed;
+	struct timespec cl_when;
+};
+static struct cpulimit cpulimits[CPUMASK_MAXCPUS];
+
+static
+void
+proc_cpulimit_expired(void *data)
+{
+	struct cpulimit *cl = data;
+
+	cl->cl_armed = false;
+}
+
+/*
+ * Make a new node. Nodes are never freed, only recycled, so their
+ * wait lock and cv are made once here.
+ */
+static
+struct node *
+node_create(void){
+  struct node *n;
+
+  n = kmalloc(sizeof(struct node));
+  if(n == NULL){
+    return NULL;
+  }
+  n->waitlock = lock_create("proc_wait");
+  if(n->waitlock == NULL){
+    kfree(n);
+    return NULL;
+  }
+  n->waitcv = cv_create("proc_wait");
+  if(n->waitcv == NULL){
+    lock_destroy(n->waitlock);
+    kfree(n);
+    return NULL;
+  }
+  return n;
+}
+
+static
+void
+node_destroy(struct node *n){
+  cv_destroy(n->waitcv);
+  lock_destroy(n->waitlock);
+  kfree(n);
+}
+
+void node_addchild(struct node *parent, struct node *child){
+  KASSERT(child->sibling == NULL);
+  child->parent = parent->pid;
+  child->sibling = parent->children;
+  parent->children = child;
+}
+
+void node_reap(struct node *n){
+  struct node *parent, **np;
+
+  if(n->parent != 0){
+    parent = get_node(n->parent);
+    KASSERT(parent != NULL);
+    for(np = &parent->children; *np != n; np = &(*np)->sibling){
+      KASSERT(*np != NULL);
+    }
+    *np = n->sibling;
+    n->sibling = NULL;
+    n->parent = 0;
+  }
+  KASSERT(n->children == NULL);
+  KASSERT(get_node(n->pid) == n);
+
+  proctable[n->pid >> PIDTABLE_LEAFBITS][n->pid & (PIDTABLE_LEAFSIZE - 1)] =
+    NULL;
+  n->status = 0;
+  n->nproc = NULL;
+  bitmap_unmark(pidmap, n->pid);
+  array_add(recycletable, n, NULL);
+}
 #endif //OPT_A2
 
 /*
@@ -101,6 +247,9 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+#if OPT_A2
+	unsigned i;
+#endif
 
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
@@ -120,11 +269,25 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	proc->p_filetable = NULL;
 
-#ifdef UW
-	proc->console = NULL;
-#endif // UW
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_cusage, sizeof(proc->p_cusage));
 
+#if OPT_A2
+	proc->p_vforksem = NULL;
+	proc->p_uthreadlock = NULL;
+	proc->p_uthreadcv = NULL;
+	proc->p_uthreads = NULL;
+	proc->p_nexttid = 1;	/* the first thread is 0 */
+	proc->p_nthreads = 0;
+	proc->p_exiting = false;
+	for (i=0; i<__RLIMIT_NUM; i++) {
+		proc->p_rlimit[i].rlim_cur = RLIM_INFINITY;
+		proc->p_rlimit[i].rlim_max = RLIM_INFINITY;
+	}
+	proc->p_cpuexceeded = false;
+#endif //OPT_A2
 
 	return proc;
 }
@@ -147,6 +310,26 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+#if OPT_A2
+	/*
+	 * Unhook from the proctable so nobody can find us any more.
+	 * (If we exited, sys__exit may already have recycled the
+	 * node, maybe for somebody else; if we didn't, because fork
+	 * failed, nobody will ever wait for us.)
+	 */
+	rwlock_acquire_write(proctable_lock);
+	struct node *n = get_node(proc->pid);
+	if (n != NULL && n->nproc == proc) {
+		if (n->status == 1) {
+			node_reap(n);
+		}
+		else {
+			n->nproc = NULL;
+		}
+	}
+	rwlock_release_write(proctable_lock);
+#endif //OPT_A2
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -180,11 +363,20 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
-	if (proc->console) {
-	  vfs_close(proc->console);
+	if (proc->p_filetable) {
+		filetable_destroy(proc->p_filetable);
+		proc->p_filetable = NULL;
 	}
-#endif // UW
+
+#if OPT_A2
+	KASSERT(proc->p_uthreads == NULL);
+	if (proc->p_uthreadcv != NULL) {
+		cv_destroy(proc->p_uthreadcv);
+	}
+	if (proc->p_uthreadlock != NULL) {
+		lock_destroy(proc->p_uthreadlock);
+	}
+#endif //OPT_A2
 
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
@@ -217,12 +409,23 @@ void
 proc_bootstrap(void)
 {
 #if OPT_A2
-  pid_count = 1;
-  proctable_lock = lock_create("proctable_lock");
-  wait_cv = cv_create("wait_cv");
+  proctable_lock = rwlock_create("proctable_lock");
+  pidmap = bitmap_create(PID_MAX + 1);
+  if (pidmap == NULL) {
+    panic("could not create pid bitmap\n");
+  }
+  for (unsigned i=0; i<PID_MIN; i++) {
+    bitmap_mark(pidmap, i);
+  }
+  pid_next = PID_MIN;
 
-  proctable = array_create();
   recycletable = array_create();
+
+  for (unsigned i=0; i<CPUMASK_MAXCPUS; i++) {
+    timeout_init(&cpulimits[i].cl_timeout, proc_cpulimit_expired,
+                 &cpulimits[i]);
+    cpulimits[i].cl_armed = false;
+  }
 #endif //OPT_A2
 
   kproc = proc_create("[kernel]");
@@ -242,6 +445,46 @@ proc_bootstrap(void)
 #endif // UW 
 }
 
+/*
+ * Give a new process its open files: a copy of its creator's file
+ * table, or, for a process the kernel starts (from the menu), the
+ * console on the standard descriptors.
+ */
+static
+int
+proc_initfiles(struct proc *proc)
+{
+	struct filetable *ft;
+	struct openfile *of;
+	char path[sizeof("con:")];
+	int fd, i, result;
+
+	if (curproc->p_filetable != NULL) {
+		return filetable_copy(curproc->p_filetable,
+				      &proc->p_filetable);
+	}
+
+	ft = filetable_create();
+	if (ft == NULL) {
+		return ENOMEM;
+	}
+	for (i = STDIN_FILENO; i <= STDERR_FILENO; i++) {
+		/* vfs_open destroys the path */
+		strcpy(path, "con:");
+		result = openfile_open(path,
+				       i == STDIN_FILENO ? O_RDONLY : O_WRONLY,
+				       0, &of);
+		if (result) {
+			filetable_destroy(ft);
+			return result;
+		}
+		result = filetable_place(ft, of, OPEN_MAX, &fd);
+		KASSERT(result == 0 && fd == i);
+	}
+	proc->p_filetable = ft;
+	return 0;
+}
+
 /*
  * Create a fresh proc for use by runprogram.
  *
@@ -252,45 +495,76 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
-	char *console_path;
 
 	proc = proc_create(name);
 	if (proc == NULL) {
 		return NULL;
 	}
 
+	if (proc_initfiles(proc)) {
+		goto fail;
+	}
+
 #if OPT_A2
-	struct node *n = kmalloc(sizeof(struct node));
+	struct node *n;
+	unsigned num, pid;
 
-	if(array_num(recycletable) == 0){
-	  proc->pid = pid_count;
+	proc->p_uthreadlock = lock_create("p_uthreadlock");
+	if(proc->p_uthreadlock == NULL){
+	  goto fail;
+	}
+	proc->p_uthreadcv = cv_create("p_uthreadcv");
+	if(proc->p_uthreadcv == NULL){
+	  goto fail;
+	}
+	proc->p_nthreads = 1;
+
+	rwlock_acquire_write(proctable_lock);
+	if(bitmap_alloc_from(pidmap, pid_next, &pid)){
+	  /* all PID_MAX of them in use */
+	  rwlock_release_write(proctable_lock);
+	  goto fail;
+	}
+	pid_next = (pid == PID_MAX) ? PID_MIN : pid + 1;
+
+	num = array_num(recycletable);
+	if(num == 0){
+	  n = node_create();
+	  if(n == NULL){
+	    bitmap_unmark(pidmap, pid);
+	    rwlock_release_write(proctable_lock);
+	    goto fail;
+	  }
 	}
 	else{
-	  pid_t *r = array_get(recycletable, 0);
-	  array_remove(recycletable, 0);
-	  proc->pid = *r;
+	  /* take from the end, so nothing has to shift down */
+	  n = array_get(recycletable, num - 1);
+	  array_remove(recycletable, num - 1);
 	}
 
-  	n->pid = proc->pid;
+	n->pid = pid;
+	proc->pid = n->pid;
+	n->nproc = proc;
 	n->parent = 0;
 	n->exitcode = 0;
 	n->status = 1;
-
-	array_add(proctable, n, NULL);
+	n->children = NULL;
+	n->sibling = NULL;
+
+	if(proctable_add(n)){
+	  bitmap_unmark(pidmap, pid);
+	  if(num == 0){
+	    node_destroy(n);
+	  }
+	  else{
+	    array_add(recycletable, n, NULL);
+	  }
+	  rwlock_release_write(proctable_lock);
+	  goto fail;
+	}
+	rwlock_release_write(proctable_lock);
 #endif //OPT_A2
 
-#ifdef UW
-	/* open the console - this should always succeed */
-	console_path = kstrdup("con:");
-	if (console_path == NULL) {
-	  panic("unable to copy console path name during process creation\n");
-	}
-	if (vfs_open(console_path,O_WRONLY,0,&(proc->console))) {
-	  panic("unable to open the console during process creation\n");
-	}
-	kfree(console_path);
-#endif // UW
-	  
 	/* VM fields */
 
 	proc->p_addrspace = NULL;
@@ -320,15 +594,28 @@ proc_create_runprogram(const char *name)
            are created using a call to proc_create_runprogram  */
 	P(proc_count_mutex); 
 	proc_count++;
-
-#if OPT_A2
-	pid_count = pid_count + 1;
-#endif //OPT_A2
-
 	V(proc_count_mutex);
 #endif // UW
 
 	return proc;
+
+ fail:
+#if OPT_A2
+	if (proc->p_uthreadcv != NULL) {
+		cv_destroy(proc->p_uthreadcv);
+	}
+	if (proc->p_uthreadlock != NULL) {
+		lock_destroy(proc->p_uthreadlock);
+	}
+#endif //OPT_A2
+	if (proc->p_filetable != NULL) {
+		filetable_destroy(proc->p_filetable);
+	}
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	kfree(proc->p_name);
+	kfree(proc);
+	return NULL;
 }
 
 /*
@@ -355,22 +642,31 @@ proc_addthread(struct proc *proc, struct thread *t)
 /*
  * Remove a thread from its process. Either the thread or the process
  * might or might not be current.
+ *
+ * The thread's resource usage stays behind in p_usage.
  */
 void
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
+	struct usage u;
 	unsigned i, num;
 
 	proc = t->t_proc;
 	KASSERT(proc != NULL);
 
+	if (t == curthread) {
+		thread_usage_charge(false);
+	}
+	thread_getusage(t, &u);
+
 	spinlock_acquire(&proc->p_lock);
 	/* ugh: find the thread in the array */
 	num = threadarray_num(&proc->p_threads);
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			usage_add(&proc->p_usage, &u);
 			spinlock_release(&proc->p_lock);
 			t->t_proc = NULL;
 			return;
@@ -381,10 +677,121 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+/*
+ * Get the resource usage of a process: for RUSAGE_SELF, what its
+ * threads have used, both the live ones and those that have gone;
+ * for RUSAGE_CHILDREN, what its children used, once they've been
+ * waited for. The live threads' counts may be a little stale.
+ */
+int
+proc_getusage(struct proc *proc, int who, struct usage *u)
+{
+	struct usage tu;
+	unsigned i, num;
+
+	spinlock_acquire(&proc->p_lock);
+	switch (who) {
+	    case RUSAGE_SELF:
+		*u = proc->p_usage;
+		num = threadarray_num(&proc->p_threads);
+		for (i=0; i<num; i++) {
+			thread_getusage(threadarray_get(&proc->p_threads, i),
+					&tu);
+			usage_add(u, &tu);
+		}
+		break;
+	    case RUSAGE_CHILDREN:
+		*u = proc->p_cusage;
+		break;
+	    default:
+		spinlock_release(&proc->p_lock);
+		return EINVAL;
+	}
+	spinlock_release(&proc->p_lock);
+	return 0;
+}
+
+#if OPT_A2
+rlim_t
+proc_getrlimit(struct proc *proc, int resource)
+{
+	rlim_t ret;
+
+	KASSERT(resource >= 0 && resource < __RLIMIT_NUM);
+
+	spinlock_acquire(&proc->p_lock);
+	ret = proc->p_rlimit[resource].rlim_cur;
+	spinlock_release(&proc->p_lock);
+	return ret;
+}
+
+/*
+ * Called on every trap from user mode, once the time spent there has
+ * been charged, and from schedule(), for the process that was
+ * running. If it has used up its RLIMIT_CPU, flag it; its threads
+ * see the flag on their way back to user mode and the process dies
+ * as if from SIGXCPU. (See uthread_checkexit.) If not, arrange to be
+ * interrupted when it might have: each of its threads could be using
+ * up the rest at once.
+ */
+void
+proc_checkcpulimit(struct proc *proc)
+{
+	struct usage u;
+	struct cpulimit *cl;
+	struct timespec when;
+	uint64_t used, left;
+	uint32_t nsecs;
+	rlim_t max;
+	int spl;
+
+	if (proc == kproc || proc->p_cpuexceeded) {
+		return;
+	}
+	max = proc_getrlimit(proc, RLIMIT_CPU);
+	if (max == RLIM_INFINITY) {
+		return;
+	}
+	proc_getusage(proc, RUSAGE_SELF, &u);
+	used = u.u_utime + u.u_stime;
+	if (used / 1000000000 >= max) {
+		proc->p_cpuexceeded = true;
+		return;
+	}
+
+	left = (uint64_t)max * 1000000000 - used;
+	if (proc->p_nthreads > 1) {
+		left /= proc->p_nthreads;
+	}
+
+	spl = splhigh();
+	gettime_fast(&when.tv_sec, &nsecs);
+	left += nsecs;
+	when.tv_sec += left / 1000000000;
+	when.tv_nsec = left % 1000000000;
+
+	cl = &cpulimits[curcpu->c_number];
+	if (!cl->cl_armed || when.tv_sec < cl->cl_when.tv_sec ||
+	    (when.tv_sec == cl->cl_when.tv_sec &&
+	     when.tv_nsec < cl->cl_when.tv_nsec)) {
+		if (timeout_set(&cl->cl_timeout, &when)) {
+			cl->cl_armed = true;
+			cl->cl_when = when;
+		}
+	}
+	splx(spl);
+}
+#endif //OPT_A2
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
  * set up a refcount scheme or some other method to make this safe.
+ *
+ * This is called on every context switch (from as_activate), so it
+ * doesn't take p_lock: p_addrspace is a single aligned word, which
+ * is read atomically, and only threads of the process itself change
+ * it. curproc_setas still locks so setters don't race each other.
  */
 struct addrspace *
 curproc_getas(void)
@@ -399,9 +806,7 @@ curproc_getas(void)
 	}
 #endif
 
-	spinlock_acquire(&curproc->p_lock);
 	as = curproc->p_addrspace;
-	spinlock_release(&curproc->p_lock);
 	return as;
 }
 
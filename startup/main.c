@@ -47,6 +47,9 @@
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <qsbr.h>
+#include <lockstat.h>
+#include <workqueue.h>
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -109,14 +112,19 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
-	hardclock_bootstrap();
+	qsbr_bootstrap();
 	vfs_bootstrap();
+	futex_bootstrap();
 
 	/* Probe and initialize devices. Interrupts should come on. */
 	kprintf("Device probe...\n");
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+#if OPT_LOCKSTAT
+	/* The clock is attached now, so locks can be timed. */
+	lockstat_bootstrap();
+#endif
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
@@ -125,9 +133,11 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
+	vfs_syncer_start();
 
 
 	/*
@@ -147,6 +157,7 @@ shutdown(void)
 
 	kprintf("Shutting down.\n");
 	
+	vfs_syncer_stop();
 	vfs_clearbootfs();
 	vfs_clearcurdir();
 	vfs_unmountall();
@@ -37,11 +37,13 @@
 #include <clock.h>
 #include <thread.h>
 #include <proc.h>
+#include <current.h>
 #include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockstat.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -191,6 +193,115 @@ cmd_prog(int nargs, char **args)
 	return common_prog(nargs, args);
 }
 
+/*
+ * Command for showing processor sets or moving a cpu to one.
+ */
+static
+int
+cmd_pset(int nargs, char **args)
+{
+	cpumask_t cpus;
+	unsigned i, j;
+
+	if (nargs == 3) {
+		return pset_assign(atoi(args[1]), atoi(args[2]));
+	}
+	if (nargs != 1) {
+		kprintf("Usage: pset [set cpu]\n");
+		return EINVAL;
+	}
+
+	for (i=0; i<PSET_MAX; i++) {
+		cpus = pset_getcpus(i);
+		if (cpus == 0) {
+			continue;
+		}
+		kprintf("pset %u:", i);
+		for (j=0; j<CPUMASK_MAXCPUS; j++) {
+			if (cpus & CPUMASK_BIT(j)) {
+				kprintf(" cpu%u", j);
+			}
+		}
+		kprintf("\n");
+	}
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for showing lock contention statistics: the N (default 20)
+ * locks waited for longest, or "reset" to zero the counters.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [count | reset]\n");
+		return EINVAL;
+	}
+
+	lockstat_print(nargs == 2 ? (unsigned)atoi(args[1]) : 20);
+	return 0;
+}
+#endif
+
+/*
+ * Command for showing system call statistics: the N (default 10)
+ * calls that have taken the most time, or "reset" to zero the
+ * counters.
+ */
+static
+int
+cmd_sysstat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscall_resetstats();
+		return 0;
+	}
+	if (nargs > 2) {
+		kprintf("Usage: sysstat [count | reset]\n");
+		return EINVAL;
+	}
+
+	syscall_printstats(nargs == 2 ? (unsigned)atoi(args[1]) : 10);
+	return 0;
+}
+
+/*
+ * Command for running a userlevel program in a processor set. The
+ * menu thread joins the set while it starts the program (which
+ * inherits it) and waits for it to finish.
+ */
+static
+int
+cmd_psetrun(int nargs, char **args)
+{
+	unsigned oldpset;
+	int result;
+
+	if (nargs < 3) {
+		kprintf("Usage: psetrun set program [arguments]\n");
+		return EINVAL;
+	}
+
+	oldpset = thread_getpset(curthread);
+	result = thread_setpset(curthread, atoi(args[1]));
+	if (result) {
+		return result;
+	}
+
+	/* drop the leading "psetrun set" */
+	result = common_prog(nargs - 2, args + 2);
+
+	thread_setpset(curthread, oldpset);
+	return result;
+}
+
 /*
  * Command for starting the system shell.
  */
@@ -454,6 +565,12 @@ static const char *opsmenu[] = {
         "[dth]     Endable DB_THREADS message",
 	"[s]       Shell                     ",
 	"[p]       Other program             ",
+	"[pset]    Show/set processor sets   ",
+	"[psetrun] Program in processor set  ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
+	"[sysstat] System call stats         ",
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
@@ -485,12 +602,20 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Work queue test               ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] RW lock test                  ",
+	"[sy5] RW lock downgrade test        ",
+	"[sy6] Seqlock and QSBR test         ",
+	"[sy7] Priority inheritance test     ",
+#if OPT_A2
+	"[pt1] Concurrent wait test          ",
+#endif
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -565,6 +690,12 @@ static struct {
         { "dth",        cmd_dth },
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
+	{ "pset",	cmd_pset },
+	{ "psetrun",	cmd_psetrun },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
+	{ "sysstat",	cmd_sysstat },
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
@@ -600,11 +731,20 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwtest },
+	{ "sy5",	rwtest2 },
+	{ "sy6",	qsbrtest },
+	{ "sy7",	pitest },
+#if OPT_A2
+	/* process tests */
+	{ "pt1",	waittest },
+#endif
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
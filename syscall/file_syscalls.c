@@ -1,5 +1,8 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
 #include <kern/unistd.h>
 #include <lib.h>
 #include <uio.h>
@@ -8,53 +11,356 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <thread.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <file.h>
+
+#include "opt-A2.h"
 
-/* handler for write() system call                  */
 /*
- * n.b.
- * This implementation handles only writes to standard output 
- * and standard error, both of which go to the console.
- * Also, it does not provide any synchronization, so writes
- * are not atomic.
- *
- * You will need to improve this implementation
+ * File system calls. Descriptors index the process's filetable; the
+ * openfiles they point to (and their seek positions) may be shared
+ * with other descriptors and other processes. See file.h.
+ */
+
+/*
+ * The most descriptors a process may have: OPEN_MAX, or less if
+ * RLIMIT_NOFILE says so.
  */
+static
+unsigned
+file_maxfds(void)
+{
+#if OPT_A2
+  rlim_t max = proc_getrlimit(curproc, RLIMIT_NOFILE);
+
+  return max < OPEN_MAX ? (unsigned)max : OPEN_MAX;
+#else
+  return OPEN_MAX;
+#endif
+}
 
 int
-sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
 {
-  struct iovec iov;
+  struct openfile *of;
+  char *path;
+  int result;
+
+  path = kmalloc(PATH_MAX);
+  if(path == NULL){
+    return ENOMEM;
+  }
+  result = copyinstr(upath, path, PATH_MAX, NULL);
+  if(result){
+    kfree(path);
+    return result;
+  }
+
+  result = openfile_open(path, flags, mode, &of);
+  kfree(path);
+  if(result){
+    return result;
+  }
+
+  result = filetable_place(curproc->p_filetable, of, file_maxfds(), retval);
+  if(result){
+    openfile_decref(of);
+    return result;
+  }
+  return 0;
+}
+
+int
+sys_close(int fd)
+{
+  struct openfile *of;
+  int result;
+
+  result = filetable_remove(curproc->p_filetable, fd, &of);
+  if(result){
+    return result;
+  }
+  openfile_decref(of);
+  return 0;
+}
+
+/*
+ * All the reads and writes come here. Transfer NBYTES between FD and
+ * the user buffers IOV[0..IOVCNT-1] (which hold exactly that much).
+ *
+ * If POS is -1, use and advance the openfile's seek position. Then
+ * the openfile's lock is held across the I/O, so that I/O through a
+ * shared openfile happens in order and the seek position moves by
+ * the right amount. Otherwise (pread and pwrite) do the I/O at POS,
+ * and leave the seek position and the lock alone.
+ */
+static
+int
+file_io(int fd, struct iovec *iov, unsigned iovcnt, size_t nbytes, off_t pos,
+	enum uio_rw rw, int *retval)
+{
+  struct openfile *of;
   struct uio u;
-  int res;
+  struct stat st;
+  bool positional = (pos != -1);
+  int result;
 
-  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
-  
-  /* only stdout and stderr writes are currently implemented */
-  if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
-    return EUNIMP;
+  result = filetable_get(curproc->p_filetable, fd, &of);
+  if(result){
+    return result;
+  }
+  if(of->of_accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY)){
+    openfile_decref(of);
+    return EBADF;
   }
-  KASSERT(curproc != NULL);
-  KASSERT(curproc->console != NULL);
-  KASSERT(curproc->p_addrspace != NULL);
 
-  /* set up a uio structure to refer to the user program's buffer (ubuf) */
-  iov.iov_ubase = ubuf;
-  iov.iov_len = nbytes;
-  u.uio_iov = &iov;
-  u.uio_iovcnt = 1;
-  u.uio_offset = 0;  /* not needed for the console */
+  if(positional){
+    /* this is where the console says ESPIPE */
+    result = VOP_TRYSEEK(of->of_vnode, pos);
+    if(result){
+      openfile_decref(of);
+      return result;
+    }
+  }
+  else{
+    lock_acquire(of->of_lock);
+    if(rw == UIO_WRITE && of->of_append){
+      result = VOP_STAT(of->of_vnode, &st);
+      if(result){
+        lock_release(of->of_lock);
+        openfile_decref(of);
+        return result;
+      }
+      of->of_offset = st.st_size;
+    }
+    pos = of->of_offset;
+  }
+
+  /* set up a uio structure to refer to the user program's buffers */
+  u.uio_iov = iov;
+  u.uio_iovcnt = iovcnt;
+  u.uio_offset = pos;
   u.uio_resid = nbytes;
   u.uio_segflg = UIO_USERSPACE;
-  u.uio_rw = UIO_WRITE;
+  u.uio_rw = rw;
   u.uio_space = curproc->p_addrspace;
 
-  res = VOP_WRITE(curproc->console,&u);
-  if (res) {
-    return res;
+  if(rw == UIO_READ){
+    result = VOP_READ(of->of_vnode, &u);
+  }
+  else{
+    result = VOP_WRITE(of->of_vnode, &u);
+  }
+  if(!positional){
+    of->of_offset = u.uio_offset;
+    lock_release(of->of_lock);
+  }
+  openfile_decref(of);
+  if(result){
+    return result;
   }
 
-  /* pass back the number of bytes actually written */
+  /* pass back the number of bytes actually transferred */
   *retval = nbytes - u.uio_resid;
   KASSERT(*retval >= 0);
+  if(rw == UIO_READ){
+    thread_usage_count(0, *retval, 0);
+  }
+  else{
+    thread_usage_count(0, 0, *retval);
+  }
+  return 0;
+}
+
+/* For a single buffer */
+static
+int
+file_rw(int fd, userptr_t ubuf, size_t nbytes, off_t pos, enum uio_rw rw,
+	int *retval)
+{
+  struct iovec iov;
+
+  iov.iov_ubase = ubuf;
+  iov.iov_len = nbytes;
+  return file_io(fd, &iov, 1, nbytes, pos, rw, retval);
+}
+
+/*
+ * For readv and writev: copy in the user's IOVCNT iovecs and add
+ * them up. The total has to fit in the return value.
+ */
+static
+int
+file_rwv(int fd, const_userptr_t uiov, int iovcnt, enum uio_rw rw,
+	 int *retval)
+{
+  struct iovec *iov;
+  size_t nbytes;
+  int i, result;
+
+  if(iovcnt <= 0 || iovcnt > IOV_MAX){
+    return EINVAL;
+  }
+  iov = kmalloc(iovcnt * sizeof(struct iovec));
+  if(iov == NULL){
+    return ENOMEM;
+  }
+  result = copyin(uiov, iov, iovcnt * sizeof(struct iovec));
+  if(result){
+    kfree(iov);
+    return result;
+  }
+
+  nbytes = 0;
+  for(i=0; i<iovcnt; i++){
+    if(iov[i].iov_len > 0x7fffffff - nbytes){
+      kfree(iov);
+      return EINVAL;
+    }
+    nbytes += iov[i].iov_len;
+  }
+
+  result = file_io(fd, iov, iovcnt, nbytes, -1, rw, retval);
+  kfree(iov);
+  return result;
+}
+
+int
+sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  return file_rw(fdesc, ubuf, nbytes, -1, UIO_READ, retval);
+}
+
+int
+sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  return file_rw(fdesc, ubuf, nbytes, -1, UIO_WRITE, retval);
+}
+
+int
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+  return file_rwv(fd, iov, iovcnt, UIO_READ, retval);
+}
+
+int
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+  return file_rwv(fd, iov, iovcnt, UIO_WRITE, retval);
+}
+
+int
+sys_pread(int fd, userptr_t ubuf, size_t nbytes, off_t pos, int *retval)
+{
+  if(pos < 0){
+    return EINVAL;
+  }
+  return file_rw(fd, ubuf, nbytes, pos, UIO_READ, retval);
+}
+
+int
+sys_pwrite(int fd, userptr_t ubuf, size_t nbytes, off_t pos, int *retval)
+{
+  if(pos < 0){
+    return EINVAL;
+  }
+  return file_rw(fd, ubuf, nbytes, pos, UIO_WRITE, retval);
+}
+
+int
+sys_lseek(int fd, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int result;
+
+  result = filetable_get(curproc->p_filetable, fd, &of);
+  if(result){
+    return result;
+  }
+
+  lock_acquire(of->of_lock);
+  switch(whence){
+    case SEEK_SET:
+      newpos = pos;
+      break;
+    case SEEK_CUR:
+      newpos = of->of_offset + pos;
+      break;
+    case SEEK_END:
+      result = VOP_STAT(of->of_vnode, &st);
+      if(result){
+        goto out;
+      }
+      newpos = st.st_size + pos;
+      break;
+    default:
+      result = EINVAL;
+      goto out;
+  }
+  if(newpos < 0){
+    result = EINVAL;
+    goto out;
+  }
+  /* this is where the console says ESPIPE */
+  result = VOP_TRYSEEK(of->of_vnode, newpos);
+  if(result){
+    goto out;
+  }
+  of->of_offset = newpos;
+  *retval = newpos;
+
+ out:
+  lock_release(of->of_lock);
+  openfile_decref(of);
+  return result;
+}
+
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of, *old;
+  int result;
+
+  if(newfd < 0 || (unsigned)newfd >= file_maxfds()){
+    return EBADF;
+  }
+  result = filetable_get(curproc->p_filetable, oldfd, &of);
+  if(result){
+    return result;
+  }
+  if(oldfd != newfd){
+    result = filetable_replace(curproc->p_filetable, newfd, of, &old);
+    KASSERT(result == 0);
+    if(old != NULL){
+      openfile_decref(old);
+    }
+  }
+  openfile_decref(of);
+  *retval = newfd;
   return 0;
 }
+
+int
+sys_fstat(int fd, userptr_t statbuf)
+{
+  struct openfile *of;
+  struct stat st;
+  int result;
+
+  result = filetable_get(curproc->p_filetable, fd, &of);
+  if(result){
+    return result;
+  }
+  result = VOP_STAT(of->of_vnode, &st);
+  openfile_decref(of);
+  if(result){
+    return result;
+  }
+  return copyout(&st, statbuf, sizeof(st));
+}
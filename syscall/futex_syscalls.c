@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes: blocking keyed on a user address.
+ *
+ * Each address somebody is sleeping on has a struct futexq, holding a
+ * CV to sleep on. The queues live in a hash table keyed by address
+ * space and virtual address. Each bucket has a sleep lock rather than
+ * a spinlock, so FUTEX_WAIT can hold it across the copyin that reads
+ * the user word: a waker has to take the same lock, so it can't slip
+ * in between the check and the sleep.
+ *
+ * A queue is made when its first waiter arrives and freed when the
+ * last thread using it has left.
+ *
+ * A waiter also leaves, with EINTR, when its process starts exiting;
+ * futex_interrupt wakes everybody in the address space for that.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <syscall.h>
+
+#define FUTEX_HASHSIZE	64
+
+struct futexq {
+	struct addrspace *fq_as;	/* Key: address space... */
+	vaddr_t fq_addr;		/* ...and address */
+	struct cv *fq_cv;		/* Waiters sleep here */
+	unsigned fq_sleepers;		/* Waiters not yet woken */
+	unsigned fq_refs;		/* Threads using the queue */
+	struct futexq *fq_next;		/* Next in hash chain */
+};
+
+struct futexbucket {
+	struct lock *fb_lock;
+	struct futexq *fb_queues;
+};
+
+static struct futexbucket futextable[FUTEX_HASHSIZE];
+
+/*
+ * Set up the hash table. Called from boot().
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		futextable[i].fb_lock = lock_create("futex");
+		if (futextable[i].fb_lock == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futextable[i].fb_queues = NULL;
+	}
+}
+
+static
+struct futexbucket *
+futex_bucket(struct addrspace *as, vaddr_t addr)
+{
+	unsigned h;
+
+	h = ((uintptr_t)as >> 4) ^ (addr >> 2);
+	return &futextable[h % FUTEX_HASHSIZE];
+}
+
+/*
+ * Find the queue for (AS, ADDR), or NULL. Call with the bucket locked.
+ */
+static
+struct futexq *
+futexq_find(struct futexbucket *fb, struct addrspace *as, vaddr_t addr)
+{
+	struct futexq *fq;
+
+	KASSERT(lock_do_i_hold(fb->fb_lock));
+
+	for (fq = fb->fb_queues; fq != NULL; fq = fq->fq_next) {
+		if (fq->fq_as == as && fq->fq_addr == addr) {
+			return fq;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Drop a reference to a queue, freeing it if it was the last.
+ */
+static
+void
+futexq_release(struct futexbucket *fb, struct futexq *fq)
+{
+	struct futexq **fqp;
+
+	KASSERT(lock_do_i_hold(fb->fb_lock));
+	KASSERT(fq->fq_refs > 0);
+
+	fq->fq_refs--;
+	if (fq->fq_refs > 0) {
+		return;
+	}
+	KASSERT(fq->fq_sleepers == 0);
+
+	for (fqp = &fb->fb_queues; *fqp != fq; fqp = &(*fqp)->fq_next) {
+		KASSERT(*fqp != NULL);
+	}
+	*fqp = fq->fq_next;
+	cv_destroy(fq->fq_cv);
+	kfree(fq);
+}
+
+static
+int
+futex_wait(struct futexbucket *fb, struct addrspace *as,
+	   userptr_t uaddr, int val)
+{
+	struct futexq *fq;
+	int cur, result;
+
+	lock_acquire(fb->fb_lock);
+
+	/* checked under the bucket lock, so futex_interrupt can't miss us */
+	if (curproc->p_exiting) {
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+
+	result = copyin((const_userptr_t)uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	fq = futexq_find(fb, as, (vaddr_t)uaddr);
+	if (fq == NULL) {
+		fq = kmalloc(sizeof(*fq));
+		if (fq == NULL) {
+			lock_release(fb->fb_lock);
+			return ENOMEM;
+		}
+		fq->fq_cv = cv_create("futex");
+		if (fq->fq_cv == NULL) {
+			kfree(fq);
+			lock_release(fb->fb_lock);
+			return ENOMEM;
+		}
+		fq->fq_as = as;
+		fq->fq_addr = (vaddr_t)uaddr;
+		fq->fq_sleepers = 0;
+		fq->fq_refs = 0;
+		fq->fq_next = fb->fb_queues;
+		fb->fb_queues = fq;
+	}
+
+	fq->fq_refs++;
+	fq->fq_sleepers++;
+	cv_wait(fq->fq_cv, fb->fb_lock);
+	/* futex_wake or futex_interrupt took us off fq_sleepers */
+	futexq_release(fb, fq);
+
+	lock_release(fb->fb_lock);
+	return curproc->p_exiting ? EINTR : 0;
+}
+
+static
+int
+futex_wake(struct futexbucket *fb, struct addrspace *as,
+	   userptr_t uaddr, int count, int32_t *retval)
+{
+	struct futexq *fq;
+	int woken = 0;
+
+	lock_acquire(fb->fb_lock);
+
+	fq = futexq_find(fb, as, (vaddr_t)uaddr);
+	while (fq != NULL && fq->fq_sleepers > 0 && woken < count) {
+		fq->fq_sleepers--;
+		cv_signal(fq->fq_cv, fb->fb_lock);
+		woken++;
+	}
+
+	lock_release(fb->fb_lock);
+	*retval = woken;
+	return 0;
+}
+
+/*
+ * Wake every thread sleeping on a futex in AS, because its process is
+ * exiting (p_exiting is already set). They return EINTR.
+ */
+void
+futex_interrupt(struct addrspace *as)
+{
+	struct futexbucket *fb;
+	struct futexq *fq;
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		fb = &futextable[i];
+		lock_acquire(fb->fb_lock);
+		for (fq = fb->fb_queues; fq != NULL; fq = fq->fq_next) {
+			if (fq->fq_as == as && fq->fq_sleepers > 0) {
+				fq->fq_sleepers = 0;
+				cv_broadcast(fq->fq_cv, fb->fb_lock);
+			}
+		}
+		lock_release(fb->fb_lock);
+	}
+}
+
+/*
+ * futex() system call. See <kern/futex.h>.
+ */
+int
+sys_futex(userptr_t uaddr, int op, int val, int32_t *retval)
+{
+	struct addrspace *as;
+	struct futexbucket *fb;
+
+	*retval = 0;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	fb = futex_bucket(as, (vaddr_t)uaddr);
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		return futex_wait(fb, as, uaddr, val);
+	    case FUTEX_WAKE:
+		if (val < 0) {
+			return EINVAL;
+		}
+		return futex_wake(fb, as, uaddr, val, retval);
+	}
+	return EINVAL;
+}
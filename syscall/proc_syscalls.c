@@ -2,6 +2,8 @@
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <syscall.h>
 #include <current.h>
@@ -15,50 +17,86 @@
 #include <vm.h>
 #include <vfs.h>
 #include <kern/fcntl.h>
+#include <kern/signal.h>
 
 #include "opt-A2.h"
 
-  /* this implementation of sys__exit does not do anything with the exit code */
-  /* this needs to be fixed to get exit() and waitpid() working properly */
+#if OPT_A2
+static void vfork_release(struct proc *p);
+static bool uthread_single(struct proc *p);
+#endif //OPT_A2
 
-void sys__exit(int exitcode) {
+/*
+ * End the current process, leaving WAITSTATUS (as made by
+ * _MKWAIT_EXIT or _MKWAIT_SIG) for waitpid.
+ */
+static
+void
+exit_process(int waitstatus) {
 
   struct addrspace *as;
   struct proc *p = curproc;
   /* for now, just include this to keep the compiler from complaining about
      an unused variable */
-  (void)exitcode;
+  (void)waitstatus;
 
 #if OPT_A2
-  lock_acquire(proctable_lock);
+  struct node *pnode = NULL;
 
-  int index = get_node(curproc->pid);
-  struct node* cur = array_get(proctable,index);
+  /* if another thread is already exiting the process, let it */
+  if(!uthread_single(p)){
+    sys_thread_exit(0);
+  }
+
+  /* total up our usage for the parent to collect; see proc_wait */
+  struct usage ru, cru;
+  thread_usage_charge(false);
+  proc_getusage(p, RUSAGE_SELF, &ru);
+  proc_getusage(p, RUSAGE_CHILDREN, &cru);
+  usage_add(&ru, &cru);
+
+  rwlock_acquire_write(proctable_lock);
+
+  struct node* cur = get_node(curproc->pid);
+  KASSERT(cur != NULL && cur->nproc == p);
+
+  /* orphan our children; the ones that already exited can go */
+  while(cur->children != NULL){
+    struct node *temp = cur->children;
+    cur->children = temp->sibling;
+    temp->sibling = NULL;
+    temp->parent = 0;
+    if(temp->status == 2){
+      node_reap(temp);
+    }
+  }
 
   if(cur->parent != 0){
+    cur->ru = ru;
     cur->status = 2;
-    cur->exitcode = _MKWAIT_EXIT(exitcode);
-    cv_broadcast(wait_cv, proctable_lock);
+    cur->exitcode = waitstatus;
+    pnode = get_node(cur->parent);
   }
   else{
-    cur->status = 0;
-    array_add(recycletable, &cur->pid, NULL);
+    node_reap(cur);
   }
 
-  for(unsigned int i=0; i< array_num(proctable); i++){
-    struct node *temp = array_get(proctable,i);
-    if((temp->parent == cur->pid) && (temp->status == 2)){
-      temp->status = 0;
-      temp->parent = 0;
-      array_add(recycletable, &temp->pid, NULL);
-    }
-  }
+  rwlock_release_write(proctable_lock);
 
-  lock_release(proctable_lock);
+  /*
+   * Tell the parent, if it's waiting; see proc_wait. Nobody else
+   * sleeps on its waitcv. (Nodes are never freed, so pnode is still
+   * good even if the parent has exited meanwhile.)
+   */
+  if(pnode != NULL){
+    lock_acquire(pnode->waitlock);
+    cv_broadcast(pnode->waitcv, pnode->waitlock);
+    lock_release(pnode->waitlock);
+  }
 #endif //OPT_A2
 
 
-  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+  DEBUG(DB_SYSCALL,"Syscall: _exit(0x%x)\n",waitstatus);
 
   KASSERT(curproc->p_addrspace != NULL);
   as_deactivate();
@@ -70,7 +108,17 @@ void sys__exit(int exitcode) {
    * messily fatal.
    */
   as = curproc_setas(NULL);
+#if OPT_A2
+  if(p->p_vforksem != NULL){
+    /* borrowed from our parent; give it back */
+    vfork_release(p);
+  }
+  else{
+    as_destroy(as);
+  }
+#else
   as_destroy(as);
+#endif //OPT_A2
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
@@ -85,6 +133,10 @@ void sys__exit(int exitcode) {
   panic("return from thread_exit in sys_exit\n");
 }
 
+void sys__exit(int exitcode) {
+  exit_process(_MKWAIT_EXIT(exitcode));
+}
+
 
 /* stub handler for getpid() system call                */
 int
@@ -103,16 +155,155 @@ sys_getpid(pid_t *retval)
   return(0);
 }
 
-/* stub handler for waitpid() system call                */
+/*
+ * Convert resource usage to what getrusage and wait4 hand out.
+ * There's no paging, so every fault is a minor one; bytes moved by
+ * read and write are reported in 512-byte blocks.
+ */
+static
+void
+usage_to_rusage(const struct usage *u, struct rusage *ru)
+{
+  bzero(ru, sizeof(*ru));
+  ru->ru_utime.tv_sec = u->u_utime / 1000000000;
+  ru->ru_utime.tv_usec = (u->u_utime % 1000000000) / 1000;
+  ru->ru_stime.tv_sec = u->u_stime / 1000000000;
+  ru->ru_stime.tv_usec = (u->u_stime % 1000000000) / 1000;
+  ru->ru_minflt = u->u_minflt;
+  ru->ru_inblock = u->u_inbytes / 512;
+  ru->ru_oublock = u->u_outbytes / 512;
+  ru->ru_nvcsw = u->u_nvcsw;
+  ru->ru_nivcsw = u->u_nivcsw;
+}
+
+int
+sys_getrusage(int who, userptr_t usage)
+{
+  struct usage u;
+  struct rusage ru;
+  int result;
 
+  if(who == RUSAGE_SELF){
+    /* bring our own system time up to date */
+    thread_usage_charge(false);
+  }
+  result = proc_getusage(curproc, who, &u);
+  if(result){
+    return result;
+  }
+  usage_to_rusage(&u, &ru);
+  return copyout(&ru, usage, sizeof(ru));
+}
+
+/* waitpid is wait4 without the resource usage */
 int
 sys_waitpid(pid_t pid,
 	    userptr_t status,
 	    int options,
 	    pid_t *retval)
+{
+  return sys_wait4(pid, status, options, NULL, retval);
+}
+
+#if OPT_A2
+/*
+ * Wait for our child PID to exit, reap it, and hand back its wait
+ * status and resource usage (which become part of ours).
+ *
+ * Several of our threads may wait for the same child at once. Only
+ * one gets it; the others find it gone (or its pid reused by
+ * someone else's process) when they wake up, and get ECHILD.
+ */
+int
+proc_wait(pid_t pid, int *exitstatus, struct usage *ru)
+{
+  struct proc *parent = curproc;
+  struct node *me, *cur;
+  int result = 0;
+
+  rwlock_acquire_read(proctable_lock);
+  me = get_node(parent->pid);
+  rwlock_release_read(proctable_lock);
+  KASSERT(me != NULL);
+
+  /*
+   * sys__exit broadcasts on our node's waitcv with its waitlock held
+   * after changing the status, so checking the status with waitlock
+   * held can't miss it; and only our own children's exits (and our
+   * own process exiting) wake us.
+   */
+  lock_acquire(me->waitlock);
+
+  /* the lookup and the status check only need the read lock */
+  rwlock_acquire_read(proctable_lock);
+  cur = get_node(pid);
+  if(cur == NULL){
+    result = ESRCH;
+  }
+  else if(cur->parent != parent->pid){
+    result = ECHILD;
+  }
+  while(result == 0 && cur->status == 1){
+    if(parent->p_exiting){
+      /* see uthread_interrupt */
+      result = EINTR;
+      break;
+    }
+    rwlock_release_read(proctable_lock);
+    cv_wait(me->waitcv, me->waitlock);
+    rwlock_acquire_read(proctable_lock);
+
+    /* look again; another of our threads may have reaped it */
+    cur = get_node(pid);
+    if(cur == NULL || cur->parent != parent->pid){
+      result = ECHILD;
+    }
+  }
+  rwlock_release_read(proctable_lock);
+
+  if(result == 0){
+    /*
+     * Reaping needs the write lock. Look once more after getting
+     * it: another of our threads may have got there first.
+     */
+    rwlock_acquire_write(proctable_lock);
+    cur = get_node(pid);
+    if(cur == NULL || cur->parent != parent->pid || cur->status != 2){
+      result = ECHILD;
+    }
+    else{
+      *exitstatus = cur->exitcode;
+      *ru = cur->ru;
+      node_reap(cur);
+    }
+    rwlock_release_write(proctable_lock);
+  }
+
+  lock_release(me->waitlock);
+  if(result){
+    return result;
+  }
+
+  /* its usage (and its children's) is now ours to report */
+  spinlock_acquire(&parent->p_lock);
+  usage_add(&parent->p_cusage, ru);
+  spinlock_release(&parent->p_lock);
+  return 0;
+}
+#endif //OPT_A2
+
+int
+sys_wait4(pid_t pid,
+	  userptr_t status,
+	  int options,
+	  userptr_t rusage,
+	  pid_t *retval)
 {
   int exitstatus;
   int result;
+#if OPT_A2
+  struct usage ru;
+#endif
 
   /* this is just a stub implementation that always reports an
      exit status of 0, regardless of the actual exit status of
@@ -128,38 +319,10 @@ sys_waitpid(pid_t pid,
   }
 
 #if OPT_A2
-/*
-  int index = get_node(pid);
-  struct node* cur = array_get(proctable,index);
-  struct semaphore* sem = cur->nsem;
-  if(sem == NULL){
-    return ECHILD;
-  }
-  P(sem);
-  exitstatus = cur->exitcode;
-*/
-  lock_acquire(proctable_lock);
-
-  int index = get_node(pid);
-  struct node* cur = array_get(proctable,index);
-
-  struct proc* parent = curproc;
-
-  if(cur==NULL){
-    lock_release(proctable_lock);
-    return ESRCH;
-  }
-  else if(parent->pid != cur->parent){
-    lock_release(proctable_lock);
-    return ECHILD;
-  }
-  
-  while(cur->status == 1){
-    cv_wait(wait_cv, proctable_lock);
+  result = proc_wait(pid, &exitstatus, &ru);
+  if(result){
+    return result;
   }
-
-  exitstatus = cur->exitcode;
-  lock_release(proctable_lock);
 #else
   /* for now, just pretend the exitstatus is 0 */
   exitstatus = 0;
@@ -169,6 +332,19 @@ sys_waitpid(pid_t pid,
   if (result) {
     return(result);
   }
+#if OPT_A2
+  if(rusage != NULL){
+    struct rusage kru;
+
+    usage_to_rusage(&ru, &kru);
+    result = copyout(&kru, rusage, sizeof(kru));
+    if(result){
+      return result;
+    }
+  }
+#else
+  (void)rusage;
+#endif //OPT_A2
   *retval = pid;
   return(0);
 }
@@ -176,6 +352,41 @@ sys_waitpid(pid_t pid,
 
 
 #if OPT_A2
+/*
+ * Make NEWP a child of the current process, which it takes its
+ * resource limits from. Fails with EAGAIN if we already have
+ * RLIMIT_NPROC children (counting ones that have exited but haven't
+ * been waited for, since they still hold a pid).
+ */
+static
+int
+add_child(struct proc *newp){
+  struct proc *p = curproc;
+  struct node *pnode, *n;
+  rlim_t max, count;
+
+  spinlock_acquire(&p->p_lock);
+  memcpy(newp->p_rlimit, p->p_rlimit, sizeof(p->p_rlimit));
+  spinlock_release(&p->p_lock);
+  max = newp->p_rlimit[RLIMIT_NPROC].rlim_cur;
+
+  rwlock_acquire_write(proctable_lock);
+  pnode = get_node(p->pid);
+  if(max != RLIM_INFINITY){
+    count = 0;
+    for(n = pnode->children; n != NULL; n = n->sibling){
+      count++;
+    }
+    if(count >= max){
+      rwlock_release_write(proctable_lock);
+      return EAGAIN;
+    }
+  }
+  node_addchild(pnode, get_node(newp->pid));
+  rwlock_release_write(proctable_lock);
+  return 0;
+}
+
 int sys_fork(struct trapframe *tf, pid_t *retval){
   KASSERT(curproc != NULL);
 
@@ -188,9 +399,11 @@ int sys_fork(struct trapframe *tf, pid_t *retval){
     return ENOMEM;
   }
 
-  int index = get_node(newp->pid);
-  struct node* temp = array_get(proctable,index);
-  temp->parent = curProc->pid;
+  check = add_child(newp);
+  if(check!=0){
+    proc_destroy(newp);
+    return check;
+  }
 
   //copy address space
   struct addrspace *new_as;
@@ -227,75 +440,116 @@ int sys_fork(struct trapframe *tf, pid_t *retval){
 
 
 
-//
+/*
+ * Program loading, shared by execv and spawn.
+ *
+ * The arguments are copied in from the calling process first, into
+ * a struct execargs, since once we switch address spaces they're
+ * gone. Then load_program builds a new address space with the
+ * program and its arguments in it.
+ */
+struct execargs {
+  char *name;           /* program path */
+  int argc;
+  char *strings;        /* the argument strings, each rounded up to 8 */
+  size_t *offsets;      /* where each one starts in strings */
+  size_t len;           /* total length of strings */
+};
+
+#define EXEC_MAXARGS 64
+
+static
+void
+execargs_free(struct execargs *ea){
+  kfree(ea->name);
+  kfree(ea->strings);
+  kfree(ea->offsets);
+}
 
-int sys_execv(userptr_t progname, userptr_t args){
+static
+int
+execargs_copyin(userptr_t progname, userptr_t args, struct execargs *ea){
   int result;
-	
+  char *temp;
+  char *argptrs[EXEC_MAXARGS];
+  size_t actual_len, arg_len;
+
+  ea->name = NULL;
+  ea->strings = NULL;
+  ea->offsets = NULL;
+  ea->argc = 0;
+  ea->len = 0;
+
   if(progname==NULL || args ==NULL){
     return EFAULT;
   }
 
-  int num_arg=0;
-  int count=0;
-  char * temp;
-
   //copy
-  char ** arr_arg_ptr = kmalloc(ARG_MAX);
   while(true){
-    result = copyin(args + count*sizeof(char*), &temp, sizeof(char *));
-
+    result = copyin(args + ea->argc*sizeof(char*), &temp, sizeof(char *));
     if(result != 0){
       return result;
     }
-
-    arr_arg_ptr[count] = temp;
     if(temp == NULL){
       break;
     }
-    else{
-      count = count + 1;
-      num_arg = num_arg + 1;
+    if(ea->argc == EXEC_MAXARGS){
+      return E2BIG;
     }
+    argptrs[ea->argc++] = temp;
   }
 
-  if(num_arg > 64){
-    return E2BIG;
+  ea->name = kmalloc(PATH_MAX);
+  ea->strings = kmalloc(ARG_MAX);
+  ea->offsets = kmalloc((ea->argc + 1) * sizeof(size_t));
+  if(ea->name == NULL || ea->strings == NULL || ea->offsets == NULL){
+    execargs_free(ea);
+    return ENOMEM;
   }
 
-  char* name = kmalloc(PATH_MAX);
-  size_t actual_len;
-
-  result = copyinstr(progname, name, PATH_MAX, &actual_len);
+  result = copyinstr(progname, ea->name, PATH_MAX, &actual_len);
   if(result != 0){
+    execargs_free(ea);
     return result;
   }
 
-  char* arg_string = kmalloc(ARG_MAX);
-  size_t *arr_offset = kmalloc(num_arg * sizeof(size_t));
-
-  size_t temp_offset = 0;
-  for(int i=0; i<num_arg; i++){
-    size_t arg_len;
-
-    result = copyinstr((userptr_t) arr_arg_ptr[i], arg_string + temp_offset, ARG_MAX - temp_offset, &arg_len);
+  for(int i=0; i<ea->argc; i++){
+    result = copyinstr((userptr_t) argptrs[i], ea->strings + ea->len,
+                       ARG_MAX - ea->len, &arg_len);
     if(result != 0){
+      execargs_free(ea);
       return result;
     }
 
-    arr_offset[i] = temp_offset;
-    temp_offset = temp_offset + ROUNDUP(arg_len + 1, 8);
+    ea->offsets[i] = ea->len;
+    ea->len = ea->len + ROUNDUP(arg_len + 1, 8);
+    if(ea->len > ARG_MAX){
+      execargs_free(ea);
+      return E2BIG;
+    }
   }
+  return 0;
+}
 
-  // old address space
-  struct addrspace *old_as = curproc_getas();
-
+/*
+ * Make a new address space, switch to it, and load the program and
+ * arguments into it. On success, returns the old address space in
+ * OLD_AS (the caller decides what to do with it) and the entry point
+ * and stack pointer (which is also where argv is). On failure, puts
+ * the old address space back.
+ */
+static
+int
+load_program(struct execargs *ea, struct addrspace **old_as,
+             vaddr_t *entrypoint, vaddr_t *stackptr){
+  int result;
   struct addrspace *as;
   struct vnode *v;
-  vaddr_t entrypoint, stackptr;
+  vaddr_t string_top, arr_top_addr;
+  userptr_t *arr_offset_top;
 
   /* Open the file. */
-  result = vfs_open(name, O_RDONLY, 0, &v);
+  result = vfs_open(ea->name, O_RDONLY, 0, &v);
   if (result) {
     return result;
   }
@@ -308,67 +562,780 @@ int sys_execv(userptr_t progname, userptr_t args){
   }
 
   /* Switch to it and activate it. */
-  curproc_setas(as);
+  *old_as = curproc_setas(as);
   as_activate();
 
   /* Load the executable. */
-  result = load_elf(v, &entrypoint);
-  if (result) {
-    /* p_addrspace will go away when curproc is destroyed */
-    vfs_close(v);
-    return result;
-  }
+  result = load_elf(v, entrypoint);
 
   /* Done with the file now. */
   vfs_close(v);
+  if (result) {
+    goto fail;
+  }
 
   /* Define the user stack in the address space */
-  result = as_define_stack(as, &stackptr);
+  result = as_define_stack(as, stackptr);
   if (result) {
-    /* p_addrspace will go away when curproc is destroyed */
-    return result;
+    goto fail;
   }
 
-  vaddr_t string_top = USERSTACK - temp_offset;
-//  vaddr_t string_top = stackptr - temp_offset;
+  string_top = USERSTACK - ea->len;
   // copy argument string
-  result = copyout(arg_string, (userptr_t) string_top, temp_offset);
+  result = copyout(ea->strings, (userptr_t) string_top, ea->len);
   if(result != 0){ // copyout return 0 if success
-    return result;
+    goto fail;
   }
 
   // argument array
-  userptr_t * arr_offset_top = kmalloc(sizeof(userptr_t) * (num_arg+1));
-  for(int i=0; i<num_arg; i++){
-    userptr_t temp_userptr = (userptr_t) string_top + arr_offset[i];
-    arr_offset_top[i] = temp_userptr;
+  arr_offset_top = kmalloc(sizeof(userptr_t) * (ea->argc+1));
+  if(arr_offset_top == NULL){
+    result = ENOMEM;
+    goto fail;
   }
-  arr_offset_top[num_arg] = NULL;
-
+  for(int i=0; i<ea->argc; i++){
+    arr_offset_top[i] = (userptr_t) string_top + ea->offsets[i];
+  }
+  arr_offset_top[ea->argc] = NULL;
 
-  vaddr_t arr_top_addr = string_top - (sizeof(userptr_t) * (num_arg + 1));
+  arr_top_addr = string_top - (sizeof(userptr_t) * (ea->argc + 1));
 
-  result = copyout(arr_offset_top, (userptr_t) arr_top_addr, sizeof(userptr_t) * (num_arg + 1));
+  result = copyout(arr_offset_top, (userptr_t) arr_top_addr,
+                   sizeof(userptr_t) * (ea->argc + 1));
+  kfree(arr_offset_top);
   if(result != 0){ // copyout return 0 if success
+    goto fail;
+  }
+
+  *stackptr = arr_top_addr;
+  return 0;
+
+ fail:
+  curproc_setas(*old_as);
+  as_activate();
+  as_destroy(as);
+  return result;
+}
+
+/*
+ * A vforked child is done with its parent's address space, because
+ * it has exec'd or is exiting: let the parent go on.
+ */
+static
+void
+vfork_release(struct proc *p){
+  struct semaphore *sem = p->p_vforksem;
+
+  KASSERT(sem != NULL);
+  p->p_vforksem = NULL;
+  V(sem);
+}
+
+int sys_execv(userptr_t progname, userptr_t args){
+  int result;
+  struct execargs ea;
+  struct addrspace *old_as;
+  vaddr_t entrypoint, stackptr;
+
+  result = execargs_copyin(progname, args, &ea);
+  if(result != 0){
     return result;
   }
 
+  /*
+   * Nobody else can be running in the address space we're about to
+   * replace, so the other threads go first (even if the exec then
+   * fails).
+   */
+  if(!uthread_single(curproc)){
+    execargs_free(&ea);
+    sys_thread_exit(0);
+  }
+  curproc->p_exiting = false;
 
-  as_destroy(old_as);
-  kfree(arr_arg_ptr);
-  kfree(name);
-  kfree(arg_string);
-  kfree(arr_offset);
-  kfree(arr_offset_top);
+  result = load_program(&ea, &old_as, &entrypoint, &stackptr);
+  if(result != 0){
+    execargs_free(&ea);
+    return result;
+  }
+
+  /* if we borrowed it (vfork) it isn't ours to destroy */
+  if(curproc->p_vforksem != NULL){
+    vfork_release(curproc);
+  }
+  else{
+    as_destroy(old_as);
+  }
 
   /* Warp to user mode. */
-  enter_new_process(num_arg /*argc*/, (userptr_t)arr_top_addr /*userspace addr of argv*/,arr_top_addr, entrypoint);
+  int argc = ea.argc;
+  execargs_free(&ea);
+  enter_new_process(argc, (userptr_t)stackptr /*userspace addr of argv*/,
+                    stackptr, entrypoint);
 
   /* enter_new_process does not return. */
   panic("enter_new_process returned\n");
   return EINVAL;
 }
 
+/*
+ * vfork: like fork, but the child borrows our address space instead
+ * of copying it, and we sleep until it's done with it (see
+ * vfork_release). That's all a child that's going to exec needs.
+ */
+int sys_vfork(struct trapframe *tf, pid_t *retval){
+  KASSERT(curproc != NULL);
 
-#endif //OPT_A2
+  int check;
+  pid_t pid;
+  struct proc* curProc = curproc;
+  struct proc* newp;
+  struct trapframe* new_tf;
+  struct semaphore* sem;
+
+  sem = sem_create("vfork", 0);
+  if(sem == NULL){
+    return ENOMEM;
+  }
+  new_tf = kmalloc(sizeof(struct trapframe));
+  if(new_tf == NULL){
+    sem_destroy(sem);
+    return ENOMEM;
+  }
+  *new_tf = *tf;
+
+  newp = proc_create_runprogram(curProc->p_name);
+  if(newp == NULL){
+    kfree(new_tf);
+    sem_destroy(sem);
+    return ENOMEM;
+  }
+
+  check = add_child(newp);
+  if(check!=0){
+    proc_destroy(newp);
+    kfree(new_tf);
+    sem_destroy(sem);
+    return check;
+  }
+
+  newp->p_addrspace = curproc_getas();
+  newp->p_vforksem = sem;
+  pid = newp->pid;
+
+  check = thread_fork(curthread->t_name, newp, enter_forked_process, new_tf, 0);
+  if(check!=0){
+    newp->p_addrspace = NULL;
+    newp->p_vforksem = NULL;
+    proc_destroy(newp);
+    kfree(new_tf);
+    sem_destroy(sem);
+    return check;
+  }
+
+  /* the child may be gone by the time we wake up; don't touch newp */
+  P(sem);
+  sem_destroy(sem);
+
+  *retval = pid;
+  return(0);
+}
+
+/*
+ * spawn: make a child process running PROGNAME with ARGS directly,
+ * without forking first. The child's first thread loads the program
+ * into the child's own address space (load_elf loads into the
+ * current process, and our other threads are still using ours) while
+ * we wait, so errors come back to us.
+ */
+struct spawninfo {
+  struct execargs *ea;
+  struct semaphore *sem;        /* V'd once the load is done */
+  int result;
+};
+
+static
+void
+enter_spawned_process(void *data, unsigned long junk){
+  struct spawninfo *si = (struct spawninfo *)data;
+  struct addrspace *old_as;
+  vaddr_t entrypoint, stackptr;
+  int argc, result;
+
+  (void)junk;
+
+  result = load_program(si->ea, &old_as, &entrypoint, &stackptr);
+  argc = si->ea->argc;
+  si->result = result;
+  if(result != 0){
+    /* our parent cleans up the process; don't touch si after V */
+    proc_remthread(curthread);
+    V(si->sem);
+    thread_exit();
+  }
+  KASSERT(old_as == NULL);
+  V(si->sem);
+
+  enter_new_process(argc, (userptr_t)stackptr, stackptr, entrypoint);
+}
+
+int sys_spawn(userptr_t progname, userptr_t args, pid_t *retval){
+  KASSERT(curproc != NULL);
 
+  int result;
+  pid_t pid;
+  struct execargs ea;
+  struct spawninfo si;
+  struct proc* curProc = curproc;
+  struct proc* newp;
+
+  result = execargs_copyin(progname, args, &ea);
+  if(result != 0){
+    return result;
+  }
+
+  si.ea = &ea;
+  si.result = 0;
+  si.sem = sem_create("spawn", 0);
+  if(si.sem == NULL){
+    execargs_free(&ea);
+    return ENOMEM;
+  }
+
+  newp = proc_create_runprogram(curProc->p_name);
+  if(newp == NULL){
+    sem_destroy(si.sem);
+    execargs_free(&ea);
+    return ENOMEM;
+  }
+
+  result = add_child(newp);
+  if(result != 0){
+    proc_destroy(newp);
+    sem_destroy(si.sem);
+    execargs_free(&ea);
+    return result;
+  }
+  pid = newp->pid;
+
+  result = thread_fork(curthread->t_name, newp, enter_spawned_process, &si, 0);
+  if(result != 0){
+    proc_destroy(newp);
+    sem_destroy(si.sem);
+    execargs_free(&ea);
+    return result;
+  }
+
+  /* if it worked, the child may be gone already; don't touch newp */
+  P(si.sem);
+  sem_destroy(si.sem);
+  execargs_free(&ea);
+  if(si.result != 0){
+    /* the child's thread has detached, and it has no address space */
+    proc_destroy(newp);
+    return si.result;
+  }
+
+  *retval = pid;
+  return(0);
+}
+
+/*
+ * User threads.
+ *
+ * Every thread in a process after the first is made by
+ * thread_create and has a struct uthread, which is kept (for
+ * thread_join) until it's joined or the process exits. The first
+ * thread has id 0 and can't be joined. p_nthreads counts all the
+ * live ones. All of this is protected by p_uthreadlock.
+ *
+ * thread_exit ends one thread; when the last one goes, so does the
+ * process. _exit (and exec) end all the others first: they set
+ * p_exiting, and every other thread notices on its way back to user
+ * mode (see uthread_checkexit, called from mips_trap) and leaves.
+ * Threads asleep in thread_join, waitpid, futex waits and nanosleep
+ * are woken to do the same (nanosleep within a second); those calls
+ * fail with EINTR. A thread asleep anywhere else in the kernel, say
+ * in vfork or reading the console, keeps the exit waiting until it
+ * wakes up; there's no way to interrupt it.
+ */
+struct uthread {
+  int ut_tid;
+  struct thread *ut_thread;     /* NULL once it has exited */
+  bool ut_exited;
+  bool ut_joining;              /* somebody's in thread_join for it */
+  int ut_status;
+  struct uthread *ut_next;
+};
+
+/*
+ * Wake P's threads asleep in futex waits or proc_wait, once
+ * p_exiting is set. Each checks p_exiting with the lock we take here
+ * held before sleeping, so none can be missed.
+ *
+ * A vforked child borrows its parent's address space, and the futex
+ * sleepers there are the parent's, so leave them alone; a vforked
+ * child has only the one thread anyway.
+ */
+static
+void
+uthread_interrupt(struct proc *p){
+  struct node *me;
+
+  if(p->p_vforksem == NULL){
+    futex_interrupt(p->p_addrspace);
+  }
+
+  rwlock_acquire_read(proctable_lock);
+  me = get_node(p->pid);
+  rwlock_release_read(proctable_lock);
+  KASSERT(me != NULL);
+
+  lock_acquire(me->waitlock);
+  cv_broadcast(me->waitcv, me->waitlock);
+  lock_release(me->waitlock);
+}
+
+/*
+ * Make curthread the only thread in P, as for _exit or exec. Returns
+ * false if another thread is already doing the same; then it's us
+ * that has to go. On success p_exiting is left set.
+ */
+static
+bool
+uthread_single(struct proc *p){
+  struct uthread *ut;
+  bool others;
+
+  lock_acquire(p->p_uthreadlock);
+  if(p->p_exiting){
+    lock_release(p->p_uthreadlock);
+    return false;
+  }
+  p->p_exiting = true;
+  /* no new threads start now, so this can only go down */
+  others = p->p_nthreads > 1;
+  cv_broadcast(p->p_uthreadcv, p->p_uthreadlock);
+  lock_release(p->p_uthreadlock);
+
+  /* get the others out of the sleeps that can be interrupted */
+  if(others){
+    uthread_interrupt(p);
+  }
+
+  lock_acquire(p->p_uthreadlock);
+  while(p->p_nthreads > 1){
+    cv_wait(p->p_uthreadcv, p->p_uthreadlock);
+  }
+
+  /* nobody's left to join anyone */
+  while(p->p_uthreads != NULL){
+    ut = p->p_uthreads;
+    p->p_uthreads = ut->ut_next;
+    kfree(ut);
+  }
+  lock_release(p->p_uthreadlock);
+  return true;
+}
+
+void uthread_checkexit(void){
+  if(curproc->p_cpuexceeded){
+    /* over RLIMIT_CPU; see proc_checkcpulimit */
+    exit_process(_MKWAIT_SIG(SIGXCPU));
+  }
+  if(curproc->p_exiting){
+    sys_thread_exit(0);
+  }
+}
+
+static
+void
+uthread_start(void *data1, unsigned long data2){
+  struct trapframe tf = *(struct trapframe *)data1;
+  struct uthread *ut = (struct uthread *)data2;
+  struct proc *p = curproc;
+
+  kfree(data1);
+
+  lock_acquire(p->p_uthreadlock);
+  ut->ut_thread = curthread;
+  lock_release(p->p_uthreadlock);
+
+  uthread_checkexit();
+  as_activate();
+  mips_usermode(&tf);
+}
+
+/*
+ * thread_create: start a thread running ENTRY(ARG) on the user
+ * stack STACK in our address space, and return its id. When ENTRY
+ * returns it goes to address 0, so the user library should wrap it
+ * in something that calls thread_exit.
+ */
+int sys_thread_create(struct trapframe *tf, userptr_t entry, userptr_t stack,
+                      userptr_t arg, int *retval){
+  struct proc *p = curproc;
+  struct uthread *ut, **utp;
+  struct trapframe *new_tf;
+  int tid, result;
+
+  ut = kmalloc(sizeof(struct uthread));
+  new_tf = kmalloc(sizeof(struct trapframe));
+  if(ut == NULL || new_tf == NULL){
+    kfree(ut);
+    kfree(new_tf);
+    return ENOMEM;
+  }
+
+  *new_tf = *tf;
+  new_tf->tf_epc = (vaddr_t)entry;
+  new_tf->tf_sp = (vaddr_t)stack;
+  new_tf->tf_a0 = (vaddr_t)arg;
+  new_tf->tf_ra = 0;
+
+  lock_acquire(p->p_uthreadlock);
+  if(p->p_exiting){
+    /* we're about to go anyway */
+    lock_release(p->p_uthreadlock);
+    kfree(ut);
+    kfree(new_tf);
+    return EINTR;
+  }
+  tid = p->p_nexttid++;
+  ut->ut_tid = tid;
+  ut->ut_thread = NULL;
+  ut->ut_exited = false;
+  ut->ut_joining = false;
+  ut->ut_status = 0;
+  ut->ut_next = p->p_uthreads;
+  p->p_uthreads = ut;
+  p->p_nthreads++;
+  lock_release(p->p_uthreadlock);
+
+  result = thread_fork(curthread->t_name, p, uthread_start, new_tf,
+                       (unsigned long)ut);
+  if(result != 0){
+    lock_acquire(p->p_uthreadlock);
+    for(utp = &p->p_uthreads; *utp != ut; utp = &(*utp)->ut_next);
+    *utp = ut->ut_next;
+    p->p_nthreads--;
+    cv_broadcast(p->p_uthreadcv, p->p_uthreadlock);
+    lock_release(p->p_uthreadlock);
+    kfree(ut);
+    kfree(new_tf);
+    return result;
+  }
+
+  *retval = tid;
+  return(0);
+}
+
+/*
+ * thread_join: wait for thread TID to exit, collect its status, and
+ * forget about it. Only one thread may join a given thread.
+ */
+int sys_thread_join(int tid, userptr_t status){
+  struct proc *p = curproc;
+  struct uthread *ut, **utp;
+  int exitstatus;
+
+  lock_acquire(p->p_uthreadlock);
+  for(ut = p->p_uthreads; ut != NULL; ut = ut->ut_next){
+    if(ut->ut_tid == tid){
+      break;
+    }
+  }
+  if(ut == NULL){
+    lock_release(p->p_uthreadlock);
+    return ESRCH;
+  }
+  if(ut->ut_thread == curthread || ut->ut_joining){
+    lock_release(p->p_uthreadlock);
+    return EINVAL;
+  }
+
+  ut->ut_joining = true;
+  while(!ut->ut_exited && !p->p_exiting){
+    cv_wait(p->p_uthreadcv, p->p_uthreadlock);
+  }
+  if(!ut->ut_exited){
+    /* the process is going away; uthread_single frees ut */
+    lock_release(p->p_uthreadlock);
+    return EINTR;
+  }
+
+  exitstatus = ut->ut_status;
+  for(utp = &p->p_uthreads; *utp != ut; utp = &(*utp)->ut_next);
+  *utp = ut->ut_next;
+  kfree(ut);
+  lock_release(p->p_uthreadlock);
+
+  if(status != NULL){
+    return copyout(&exitstatus, status, sizeof(int));
+  }
+  return(0);
+}
+
+/*
+ * thread_exit: end this thread. The last thread to leave takes the
+ * process with it, with exit status STATUS.
+ */
+void sys_thread_exit(int status){
+  struct proc *p = curproc;
+  struct uthread *ut;
+
+  lock_acquire(p->p_uthreadlock);
+  if(p->p_nthreads == 1 && !p->p_exiting){
+    lock_release(p->p_uthreadlock);
+    sys__exit(status);
+  }
+
+  /*
+   * Detach first: once p_nthreads drops, an exiting thread may
+   * destroy the process. The address space stays; it's shared.
+   */
+  proc_remthread(curthread);
+
+  for(ut = p->p_uthreads; ut != NULL; ut = ut->ut_next){
+    if(ut->ut_thread == curthread){
+      ut->ut_thread = NULL;
+      ut->ut_exited = true;
+      ut->ut_status = status;
+      break;
+    }
+  }
+  KASSERT(p->p_nthreads > 1);
+  p->p_nthreads--;
+  cv_broadcast(p->p_uthreadcv, p->p_uthreadlock);
+  lock_release(p->p_uthreadlock);
+
+  thread_exit();
+}
+
+
+/*
+ * Find the process named by WHO for getpriority/setpriority; 0 means
+ * the current process. Call with proctable_lock held (for reading at
+ * least). Returns NULL if there is no such (live) process.
+ */
+static
+struct proc *
+prio_findproc(pid_t who)
+{
+  struct node *temp;
+
+  if(who == 0 || who == curproc->pid){
+    return curproc;
+  }
+
+  temp = get_node(who);
+  if(temp == NULL){
+    return NULL;
+  }
+  return temp->nproc;
+}
+
+int
+sys_getpriority(int which, pid_t who, int *retval)
+{
+  struct proc *p;
+
+  if(which != PRIO_PROCESS){
+    return EINVAL;
+  }
+
+  rwlock_acquire_read(proctable_lock);
+  p = prio_findproc(who);
+  if(p == NULL){
+    rwlock_release_read(proctable_lock);
+    return ESRCH;
+  }
+
+  spinlock_acquire(&p->p_lock);
+  if(threadarray_num(&p->p_threads) == 0){
+    /* exiting */
+    spinlock_release(&p->p_lock);
+    rwlock_release_read(proctable_lock);
+    return ESRCH;
+  }
+  *retval = thread_getnice(threadarray_get(&p->p_threads, 0));
+  spinlock_release(&p->p_lock);
+
+  rwlock_release_read(proctable_lock);
+  return(0);
+}
+
+int
+sys_setpriority(int which, pid_t who, int prio)
+{
+  struct proc *p;
+
+  if(which != PRIO_PROCESS){
+    return EINVAL;
+  }
+
+  rwlock_acquire_read(proctable_lock);
+  p = prio_findproc(who);
+  if(p == NULL){
+    rwlock_release_read(proctable_lock);
+    return ESRCH;
+  }
+
+  /* out-of-range values are clamped, as in POSIX */
+  spinlock_acquire(&p->p_lock);
+  for(unsigned int i=0; i<threadarray_num(&p->p_threads); i++){
+    thread_setnice(threadarray_get(&p->p_threads, i), prio);
+  }
+  spinlock_release(&p->p_lock);
+
+  rwlock_release_read(proctable_lock);
+  return(0);
+}
+
+/*
+ * CPU affinity and processor sets (see <thread.h>), for every thread
+ * of process WHO (0 means us). We may only change ourselves and our
+ * own children. Our own thread is done last, with no locks held,
+ * since it may have to yield to get off a cpu it can't use any more.
+ */
+static
+int
+sched_affinity(struct thread *t, unsigned long mask)
+{
+  return thread_setaffinity(t, (cpumask_t)mask);
+}
+
+static
+int
+sched_pset(struct thread *t, unsigned long pset)
+{
+  return thread_setpset(t, (unsigned)pset);
+}
+
+static
+int
+sched_apply(pid_t who, int (*func)(struct thread *, unsigned long),
+            unsigned long arg)
+{
+  struct proc *p;
+  struct node *n;
+  struct thread *t;
+  bool self;
+  int result = 0, err;
+
+  rwlock_acquire_read(proctable_lock);
+  p = prio_findproc(who);
+  if(p == NULL){
+    rwlock_release_read(proctable_lock);
+    return ESRCH;
+  }
+  if(p != curproc){
+    n = get_node(p->pid);
+    if(n == NULL || n->parent != curproc->pid){
+      rwlock_release_read(proctable_lock);
+      return EPERM;
+    }
+  }
+
+  self = false;
+  spinlock_acquire(&p->p_lock);
+  for(unsigned int i=0; i<threadarray_num(&p->p_threads); i++){
+    t = threadarray_get(&p->p_threads, i);
+    if(t == curthread){
+      self = true;
+      continue;
+    }
+    err = func(t, arg);
+    if(err && !result){
+      result = err;
+    }
+  }
+  spinlock_release(&p->p_lock);
+  rwlock_release_read(proctable_lock);
+
+  if(self){
+    err = func(curthread, arg);
+    if(err && !result){
+      result = err;
+    }
+  }
+  return result;
+}
+
+int
+sys_sched_setaffinity(pid_t pid, size_t size, const_userptr_t mask)
+{
+  cpumask_t m;
+  int result;
+
+  if(size != sizeof(m)){
+    return EINVAL;
+  }
+  result = copyin(mask, &m, sizeof(m));
+  if(result){
+    return result;
+  }
+  return sched_apply(pid, sched_affinity, m);
+}
+
+int
+sys_pset_bind(unsigned pset, pid_t pid)
+{
+  if(pset >= PSET_MAX){
+    return EINVAL;
+  }
+  return sched_apply(pid, sched_pset, pset);
+}
+
+/*
+ * Resource limits. Children inherit them (see add_child) and exec
+ * keeps them. Anybody may lower a hard limit, but not raise it.
+ *
+ * They're enforced in: as_prepare_load (RLIMIT_AS), add_child
+ * (RLIMIT_NPROC), proc_checkcpulimit on traps from user mode
+ * (RLIMIT_CPU), and open and dup2 (RLIMIT_NOFILE).
+ */
+int
+sys_getrlimit(int resource, userptr_t rlp)
+{
+  struct proc *p = curproc;
+  struct rlimit rl;
+
+  if(resource < 0 || resource >= __RLIMIT_NUM){
+    return EINVAL;
+  }
+  spinlock_acquire(&p->p_lock);
+  rl = p->p_rlimit[resource];
+  spinlock_release(&p->p_lock);
+  return copyout(&rl, rlp, sizeof(rl));
+}
+
+int
+sys_setrlimit(int resource, const_userptr_t rlp)
+{
+  struct proc *p = curproc;
+  struct rlimit rl;
+  int result;
+
+  if(resource < 0 || resource >= __RLIMIT_NUM){
+    return EINVAL;
+  }
+  result = copyin(rlp, &rl, sizeof(rl));
+  if(result){
+    return result;
+  }
+  if(rl.rlim_cur > rl.rlim_max){
+    return EINVAL;
+  }
+
+  spinlock_acquire(&p->p_lock);
+  if(rl.rlim_max > p->p_rlimit[resource].rlim_max){
+    spinlock_release(&p->p_lock);
+    return EPERM;
+  }
+  p->p_rlimit[resource] = rl;
+  spinlock_release(&p->p_lock);
+  return 0;
+}
+
+#endif //OPT_A2
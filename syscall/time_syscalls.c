@@ -28,8 +28,13 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <copyinout.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
 #include <syscall.h>
 
 /*
@@ -56,3 +61,69 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the interval in REQ. If the process starts exiting (see
+ * uthread_single) we stop early with EINTR, and if REM is given it
+ * gets what was left; otherwise it's set to zero. We sleep a second
+ * at most at a time so as not to hold up an exit for long.
+ */
+int
+sys_nanosleep(const_userptr_t req, userptr_t rem)
+{
+	struct timespec ts, when, now, next;
+	uint32_t nsecs;
+	int result, ret = 0;
+
+	result = copyin(req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	gettime(&now.tv_sec, &nsecs);
+	now.tv_nsec = nsecs;
+	when.tv_sec = now.tv_sec + ts.tv_sec;
+	when.tv_nsec = now.tv_nsec + ts.tv_nsec;
+	if (when.tv_nsec >= 1000000000) {
+		when.tv_nsec -= 1000000000;
+		when.tv_sec++;
+	}
+
+	while (now.tv_sec < when.tv_sec ||
+	       (now.tv_sec == when.tv_sec && now.tv_nsec < when.tv_nsec)) {
+		if (curproc->p_exiting) {
+			ret = EINTR;
+			break;
+		}
+		next.tv_sec = now.tv_sec + 1;
+		next.tv_nsec = now.tv_nsec;
+		if (next.tv_sec > when.tv_sec ||
+		    (next.tv_sec == when.tv_sec &&
+		     next.tv_nsec > when.tv_nsec)) {
+			next = when;
+		}
+		thread_sleep_until(&next);
+
+		gettime(&now.tv_sec, &nsecs);
+		now.tv_nsec = nsecs;
+	}
+
+	if (rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		if (ret == EINTR) {
+			getinterval(now.tv_sec, now.tv_nsec,
+				    when.tv_sec, when.tv_nsec,
+				    &ts.tv_sec, &nsecs);
+			ts.tv_nsec = nsecs;
+		}
+		result = copyout(&ts, rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+	return ret;
+}
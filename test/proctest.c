@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Process test code.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <synch.h>
+#include <syscall.h>
+#include <test.h>
+#include "opt-A2.h"
+
+#if OPT_A2
+
+#define NWAITERS  2
+#define WAITCODE  42
+
+static struct semaphore *waitgo;
+static struct semaphore *waitdone;
+static pid_t waitchildpid;
+static int waitresult[NWAITERS];
+static int waitstatus[NWAITERS];
+
+/*
+ * The child: hang around until both waiters are (probably) asleep
+ * in proc_wait, then exit.
+ */
+static
+void
+waitchild(void *junk, unsigned long junk2)
+{
+	(void)junk;
+	(void)junk2;
+
+	P(waitgo);
+	sys__exit(WAITCODE);
+}
+
+/*
+ * A thread of the parent. Both wait for the same child at once;
+ * exactly one of them should get it.
+ */
+static
+void
+waitparent(void *junk, unsigned long num)
+{
+	struct usage ru;
+
+	(void)junk;
+
+	waitresult[num] = proc_wait(waitchildpid, &waitstatus[num], &ru);
+
+	/* user process threads detach themselves; see thread_exit */
+	proc_remthread(curthread);
+	V(waitdone);
+}
+
+int
+waittest(int nargs, char **args)
+{
+	struct proc *parent, *child;
+	struct node *pnode, *cnode;
+	unsigned i, nreaped;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	waitgo = sem_create("waitgo", 0);
+	waitdone = sem_create("waitdone", 0);
+	if (waitgo == NULL || waitdone == NULL) {
+		panic("waittest: sem_create failed\n");
+	}
+
+	kprintf("Starting wait test...\n");
+
+	parent = proc_create_runprogram("waittest-parent");
+	child = proc_create_runprogram("waittest-child");
+	if (parent == NULL || child == NULL) {
+		panic("waittest: proc_create_runprogram failed\n");
+	}
+	/* sys__exit wants something to throw away */
+	child->p_addrspace = as_create();
+	if (child->p_addrspace == NULL) {
+		panic("waittest: as_create failed\n");
+	}
+
+	rwlock_acquire_write(proctable_lock);
+	pnode = get_node(parent->pid);
+	cnode = get_node(child->pid);
+	KASSERT(pnode != NULL && cnode != NULL);
+	node_addchild(pnode, cnode);
+	rwlock_release_write(proctable_lock);
+	waitchildpid = child->pid;
+
+	result = thread_fork("waitchild", child, waitchild, NULL, 0);
+	if (result) {
+		panic("waittest: thread_fork failed: %s\n", strerror(result));
+	}
+	for (i=0; i<NWAITERS; i++) {
+		result = thread_fork("waitparent", parent, waitparent,
+				     NULL, i);
+		if (result) {
+			panic("waittest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	/* give the waiters a chance to go to sleep first */
+	clocksleep(1);
+	V(waitgo);
+
+	for (i=0; i<NWAITERS; i++) {
+		P(waitdone);
+	}
+
+	nreaped = 0;
+	for (i=0; i<NWAITERS; i++) {
+		if (waitresult[i] == 0) {
+			nreaped++;
+			if (!WIFEXITED(waitstatus[i]) ||
+			    WEXITSTATUS(waitstatus[i]) != WAITCODE) {
+				panic("waittest: wrong status 0x%x\n",
+				      waitstatus[i]);
+			}
+		}
+		else if (waitresult[i] != ECHILD && waitresult[i] != ESRCH) {
+			panic("waittest: proc_wait failed: %s\n",
+			      strerror(waitresult[i]));
+		}
+	}
+	if (nreaped != 1) {
+		panic("waittest: child reaped %u times\n", nreaped);
+	}
+
+	rwlock_acquire_read(proctable_lock);
+	KASSERT(pnode->children == NULL);
+	rwlock_release_read(proctable_lock);
+
+	proc_destroy(parent);
+#ifdef UW
+	/* that was the last process; eat the wakeup meant for the menu */
+	P(no_proc_sem);
+#endif
+
+	sem_destroy(waitgo);
+	sem_destroy(waitdone);
+
+	kprintf("Wait test done\n");
+	return 0;
+}
+
+#endif /* OPT_A2 */
@@ -32,15 +32,23 @@
  */
 
 #include <types.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
+#include <current.h>
+#include <spinlock.h>
 #include <synch.h>
+#include <seqlock.h>
+#include <qsbr.h>
 #include <test.h>
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
+#define NRWLOOPS      120
+#define NQSBRLOOPS    200
 #define NTHREADS      32
 
 static volatile unsigned long testval1;
@@ -347,3 +355,511 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock tests.
+ *
+ * rwtest runs a mix of readers and writers (every fourth thread is a
+ * writer) over the same values locktest uses. Writers check nobody
+ * is reading; readers check the values are consistent and count how
+ * many of them got in at once, which should be more than one.
+ *
+ * rwtest2 has the writers downgrade to read holds and check that
+ * nobody slipped in and changed the values in between.
+ */
+
+static struct rwlock *testrwlock;
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned long rwreaders;
+static volatile unsigned long rwmaxreaders;
+static volatile bool rwfailed;
+static bool rwdowngrade;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: Mismatch on %s\n", num, msg);
+	rwfailed = true;
+}
+
+static
+void
+rwcheck(unsigned long num)
+{
+	if (testval2 != testval1*testval1) {
+		rwfail(num, "testval2/testval1");
+	}
+	if (testval3 != testval1%3) {
+		rwfail(num, "testval3/testval1");
+	}
+}
+
+static
+void
+rwreader(unsigned long num)
+{
+	rwlock_acquire_read(testrwlock);
+
+	spinlock_acquire(&rwcount_lock);
+	rwreaders++;
+	if (rwreaders > rwmaxreaders) {
+		rwmaxreaders = rwreaders;
+	}
+	spinlock_release(&rwcount_lock);
+
+	rwcheck(num);
+	thread_yield();
+	rwcheck(num);
+
+	spinlock_acquire(&rwcount_lock);
+	rwreaders--;
+	spinlock_release(&rwcount_lock);
+
+	rwlock_release_read(testrwlock);
+}
+
+static
+void
+rwwriter(unsigned long num, bool downgrade)
+{
+	rwlock_acquire_write(testrwlock);
+	if (rwreaders != 0) {
+		rwfail(num, "readers during write");
+	}
+
+	testval1 = num;
+	thread_yield();
+	testval2 = num*num;
+	testval3 = num%3;
+	rwcheck(num);
+
+	if (!downgrade) {
+		rwlock_release_write(testrwlock);
+		return;
+	}
+
+	rwlock_downgrade(testrwlock);
+	thread_yield();
+	if (testval1 != num) {
+		rwfail(num, "testval1/num after downgrade");
+	}
+	rwcheck(num);
+	rwlock_release_read(testrwlock);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 4 == 0) {
+			rwwriter(num, rwdowngrade);
+		}
+		else {
+			rwreader(num);
+		}
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+int
+common_rwtest(const char *name, bool downgrade)
+{
+	int i, result;
+
+	inititems();
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("%s: rwlock_create failed\n", name);
+	}
+	kprintf("Starting %s...\n", name);
+
+	testval1 = testval2 = testval3 = 0;
+	rwreaders = rwmaxreaders = 0;
+	rwfailed = false;
+	rwdowngrade = downgrade;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread,
+				     NULL, i);
+		if (result) {
+			panic("%s: thread_fork failed: %s\n", name,
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("At most %lu readers at once\n", rwmaxreaders);
+	if (rwfailed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("%s done.\n", name);
+
+	return 0;
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	return common_rwtest("RW lock test", false);
+}
+
+int
+rwtest2(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	return common_rwtest("RW lock downgrade test", true);
+}
+
+/*
+ * Seqlock and QSBR test.
+ *
+ * Every fourth thread is a writer. Writers update testval1 and
+ * testval2 under a seqlock, and readers check their copy is
+ * consistent. Writers also replace the item qsbrcur points to, and
+ * alternately wait with qsbr_synchronize or queue a qsbr_call before
+ * retiring the old one; readers check, inside a read section, that
+ * the item they find hasn't been retired.
+ */
+
+struct qsbritem {
+	unsigned long qi_val;
+	unsigned long qi_square;
+	volatile bool qi_retired;
+	struct qsbr_head qi_qh;
+	struct qsbritem *qi_next;	/* on qsbrgrave */
+};
+
+static struct seqlock qsbrseq = SEQLOCK_INITIALIZER;
+static struct spinlock qsbritem_lock = SPINLOCK_INITIALIZER;
+static struct qsbritem *volatile qsbrcur;
+static struct qsbritem *qsbrgrave;
+static unsigned qsbrretired;		/* items on qsbrgrave */
+static volatile bool qsbrfailed;
+
+/*
+ * Retire an item. It is only freed at the end of the test, so a
+ * reader that finds it too early sees qi_retired rather than garbage.
+ */
+static
+void
+qsbrretire(void *arg)
+{
+	struct qsbritem *qi = arg;
+
+	qi->qi_retired = true;
+	spinlock_acquire(&qsbritem_lock);
+	qi->qi_next = qsbrgrave;
+	qsbrgrave = qi;
+	qsbrretired++;
+	spinlock_release(&qsbritem_lock);
+}
+
+static
+void
+qsbrreader(unsigned long num)
+{
+	struct qsbritem *qi;
+	unsigned long v1, v2;
+	unsigned seq;
+	int spl;
+
+	spl = qsbr_read_begin();
+	qi = qsbrcur;
+	if (qi->qi_retired) {
+		kprintf("thread %lu: Found retired item\n", num);
+		qsbrfailed = true;
+	}
+	if (qi->qi_square != qi->qi_val*qi->qi_val) {
+		kprintf("thread %lu: Mismatch on item\n", num);
+		qsbrfailed = true;
+	}
+	qsbr_read_end(spl);
+
+	do {
+		seq = seqlock_read_begin(&qsbrseq);
+		v1 = testval1;
+		v2 = testval2;
+	} while (seqlock_read_retry(&qsbrseq, seq));
+	if (v2 != v1*v1) {
+		kprintf("thread %lu: Mismatch on testval2/testval1\n", num);
+		qsbrfailed = true;
+	}
+}
+
+static
+void
+qsbrwriter(unsigned long num, int i)
+{
+	struct qsbritem *qi, *old;
+
+	seqlock_write_begin(&qsbrseq);
+	testval1 = num;
+	testval2 = num*num;
+	seqlock_write_end(&qsbrseq);
+
+	qi = kmalloc(sizeof(*qi));
+	if (qi == NULL) {
+		panic("qsbrtest: Out of memory\n");
+	}
+	qi->qi_val = num + i;
+	qi->qi_square = qi->qi_val * qi->qi_val;
+	qi->qi_retired = false;
+
+	spinlock_acquire(&qsbritem_lock);
+	old = qsbrcur;
+	qsbrcur = qi;
+	spinlock_release(&qsbritem_lock);
+
+	if (i % 2) {
+		qsbr_synchronize();
+		qsbrretire(old);
+	}
+	else {
+		qsbr_call(&old->qi_qh, qsbrretire, old);
+	}
+}
+
+static
+void
+qsbrtestthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NQSBRLOOPS; i++) {
+		if (num % 4 == 0) {
+			qsbrwriter(num, i);
+		}
+		else {
+			qsbrreader(num);
+		}
+		thread_yield();
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+qsbrtest(int nargs, char **args)
+{
+	struct qsbritem *qi, *grave;
+	unsigned nwrites, nretired;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting seqlock and QSBR test...\n");
+
+	testval1 = testval2 = 0;
+	qsbrfailed = false;
+	qsbrgrave = NULL;
+	qsbrretired = 0;
+	qsbrcur = kmalloc(sizeof(*qsbrcur));
+	if (qsbrcur == NULL) {
+		panic("qsbrtest: Out of memory\n");
+	}
+	qsbrcur->qi_val = qsbrcur->qi_square = 0;
+	qsbrcur->qi_retired = false;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, qsbrtestthread,
+				     NULL, i);
+		if (result) {
+			panic("qsbrtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	/*
+	 * Every write retires one item. Wait for the last qsbr_calls to
+	 * have run (qsbr_synchronize should see to that; check), then
+	 * free everything.
+	 */
+	nwrites = ((NTHREADS + 3) / 4) * NQSBRLOOPS;
+	qsbr_synchronize();
+	spinlock_acquire(&qsbritem_lock);
+	nretired = qsbrretired;
+	grave = qsbrgrave;
+	qsbrgrave = NULL;
+	spinlock_release(&qsbritem_lock);
+	if (nretired != nwrites) {
+		kprintf("qsbrtest: %u of %u items retired after "
+			"qsbr_synchronize\n", nretired, nwrites);
+		qsbrfailed = true;
+		/* the rest are still on their way; leak them all */
+		grave = NULL;
+	}
+	while (grave != NULL) {
+		qi = grave;
+		grave = qi->qi_next;
+		kfree(qi);
+	}
+	kfree(qsbrcur);
+	qsbrcur = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	if (qsbrfailed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Seqlock and QSBR test done.\n");
+
+	return 0;
+}
+
+/*
+ * Priority inheritance test. We hold pilock1; a low-priority thread
+ * takes pilock2 and sleeps on pilock1; then a high-priority thread
+ * sleeps on pilock2. Both we and the low-priority thread should now
+ * be running at (about) the high-priority thread's priority, and
+ * each should drop back when it lets go.
+ */
+
+static struct lock *pilock1, *pilock2;
+static struct thread *volatile pilowthread;
+static bool pifailed;
+
+static
+void
+pitestlow(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_setnice(curthread, PRIO_MAX);
+	thread_yield();
+
+	lock_acquire(pilock2);
+	pilowthread = curthread;
+	lock_acquire(pilock1);
+	lock_release(pilock1);
+	lock_release(pilock2);
+
+	if (curthread->t_inheritpri != THREAD_PRI_MAX) {
+		kprintf("pitest: low thread still boosted to %d\n",
+			curthread->t_inheritpri);
+		pifailed = true;
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+pitesthigh(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_setnice(curthread, PRIO_MIN);
+	thread_yield();
+
+	lock_acquire(pilock2);
+	lock_release(pilock2);
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+pitest(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting priority inheritance test...\n");
+
+	pilock1 = lock_create("pilock1");
+	pilock2 = lock_create("pilock2");
+	if (pilock1 == NULL || pilock2 == NULL) {
+		panic("pitest: lock_create failed\n");
+	}
+	pilowthread = NULL;
+	pifailed = false;
+
+	lock_acquire(pilock1);
+
+	result = thread_fork("pitest-low", NULL, pitestlow, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	while (pilowthread == NULL) {
+		thread_yield();
+	}
+
+	result = thread_fork("pitest-high", NULL, pitesthigh, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	while (pilock1->lk_piwaiters == NULL ||
+	       pilock2->lk_piwaiters == NULL) {
+		thread_yield();
+	}
+
+	/* nice -20 gives THREAD_PRI_DEFAULT-20 plus a little usage. */
+	if (pilowthread->t_inheritpri >= THREAD_PRI_DEFAULT) {
+		kprintf("pitest: low thread not boosted (%d)\n",
+			pilowthread->t_inheritpri);
+		pifailed = true;
+	}
+	if (curthread->t_inheritpri >= THREAD_PRI_DEFAULT) {
+		kprintf("pitest: boost not passed down the chain (%d)\n",
+			curthread->t_inheritpri);
+		pifailed = true;
+	}
+
+	lock_release(pilock1);
+	if (curthread->t_inheritpri != THREAD_PRI_MAX) {
+		kprintf("pitest: still boosted to %d after release\n",
+			curthread->t_inheritpri);
+		pifailed = true;
+	}
+
+	P(donesem);
+	P(donesem);
+	lock_destroy(pilock1);
+	lock_destroy(pilock2);
+#ifdef UW
+  cleanitems();
+#endif
+	if (pifailed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Priority inheritance test done.\n");
+
+	return 0;
+}
@@ -31,9 +31,11 @@
  * Thread test code.
  */
 #include <types.h>
+#include <kern/time.h>
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <workqueue.h>
 #include <test.h>
 
 #define NTHREADS  8
@@ -144,3 +146,79 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Work queue test. Queue a batch of items, some of them delayed,
+ * that each take a little while, so the queue has to start extra
+ * workers; and queue one long-delayed item and cancel it.
+ */
+
+#define NWORKITEMS 32
+
+static struct work workitems[NWORKITEMS];
+static struct work cancelitem;
+static volatile bool cancelran;
+
+static
+void
+workitem(void *junk, unsigned long num)
+{
+	volatile int i;
+
+	(void)junk;
+
+	putch('a' + num % 26);
+	for (i=0; i<20000; i++);
+	V(tsem);
+}
+
+static
+void
+cancelwork(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	cancelran = true;
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	struct timespec delay;
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting work queue test...\n");
+
+	cancelran = false;
+	work_init(&cancelitem, cancelwork, NULL, 0);
+	delay.tv_sec = 10;
+	delay.tv_nsec = 0;
+	work_queue_delayed(&cancelitem, &delay);
+
+	for (i=0; i<NWORKITEMS; i++) {
+		work_init(&workitems[i], workitem, NULL, i);
+		if (i % 4 == 0) {
+			delay.tv_sec = 0;
+			delay.tv_nsec = 10000000 * (i / 4);
+			work_queue_delayed(&workitems[i], &delay);
+		}
+		else {
+			work_queue(&workitems[i]);
+		}
+	}
+	for (i=0; i<NWORKITEMS; i++) {
+		P(tsem);
+	}
+
+	if (!work_cancel(&cancelitem) || cancelran) {
+		kprintf("\nCancelling a delayed item failed\n");
+	}
+	kprintf("\nWork queue test done.\n");
+
+	return 0;
+}
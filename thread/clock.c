@@ -28,19 +28,25 @@
  */
 
 #include <types.h>
+#include <kern/time.h>
 #include <lib.h>
 #include <cpu.h>
-#include <wchan.h>
+#include <spl.h>
 #include <clock.h>
 #include <thread.h>
+#include <timeout.h>
 #include <current.h>
+#include <spinlock.h>
+#include <mainbus.h>
+#include <qsbr.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Each cpu's on-chip timer is run one-shot, and programmed for
+ * whichever comes first of the next hardclock (if the cpu is
+ * ticking) and the next timeout on its timer wheel. clockintr() is
+ * called when it goes off.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,34 +57,439 @@
  * the scheduler.
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+
+/* Timeout ticks per hardclock, and microseconds per timeout tick. */
+#define HARDCLOCK_TICKS	(TIMEOUT_HZ >= HZ ? TIMEOUT_HZ / HZ : 1)
+#define TICK_USECS	(1000000 / TIMEOUT_HZ)
+#define TICK_NSECS	(1000000000 / TIMEOUT_HZ)
+
+/* Wheel geometry. */
+#define WHEEL_MASK	(TIMEOUT_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(l)	((l) * TIMEOUT_WHEEL_BITS)
+#define LEVEL_SPAN(l)	((uint64_t)1 << LEVEL_SHIFT(l))
+#define WHEEL_SPAN	LEVEL_SPAN(TIMEOUT_WHEEL_LEVELS)
+
+/*
+ * Longest we let the timer go without interrupting, even with
+ * nothing to do, so the cycle counter behind gettime_fast() can't
+ * wrap around between two looks at it.
+ */
+#define CLOCK_MAXSLEEP	(60 * TIMEOUT_HZ)
+
+/*
+ * Current time, in timeout ticks.
+ */
+static
+uint64_t
+clock_ticks(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime_fast(&secs, &nsecs);
+	return (uint64_t)secs * TIMEOUT_HZ + nsecs / TICK_NSECS;
+}
+
+void
+gettime_fast(time_t *secs, uint32_t *nsecs)
+{
+	struct cpu *c;
+	uint32_t cycles, rnsecs;
+	uint64_t delta;
+	time_t rsecs;
+	bool resync;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+
+	cycles = mainbus_cycles();
+	delta = mainbus_cycles_to_nsecs(cycles - c->c_clockcycles);
+	c->c_clockcycles = cycles;
+
+	if (c->c_clocksecs == 0 || delta >= 1000000000) {
+		/* First time, or it's been a while. */
+		resync = true;
+	}
+	else {
+		resync = false;
+		c->c_clocknsecs += delta;
+		if (c->c_clocknsecs >= 1000000000) {
+			c->c_clocknsecs -= 1000000000;
+			c->c_clocksecs++;
+			/* Catch up with the real clock once a second. */
+			resync = true;
+		}
+	}
+
+	if (resync) {
+		gettime(&rsecs, &rnsecs);
+		if (rsecs > c->c_clocksecs ||
+		    (rsecs == c->c_clocksecs && rnsecs > c->c_clocknsecs)) {
+			c->c_clocksecs = rsecs;
+			c->c_clocknsecs = rnsecs;
+		}
+	}
+
+	*secs = c->c_clocksecs;
+	*nsecs = c->c_clocknsecs;
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+// timer wheel
+
+void
+timeoutwheel_init(struct timeoutwheel *tw)
+{
+	unsigned i, j;
+
+	spinlock_init(&tw->tw_lock);
+	tw->tw_now = 0;
+	for (i=0; i<TIMEOUT_WHEEL_LEVELS; i++) {
+		tw->tw_count[i] = 0;
+		for (j=0; j<TIMEOUT_WHEEL_SLOTS; j++) {
+			tw->tw_slots[i][j] = NULL;
+		}
+	}
+}
+
+static
+bool
+timeoutwheel_isempty(struct timeoutwheel *tw)
+{
+	unsigned i;
+
+	for (i=0; i<TIMEOUT_WHEEL_LEVELS; i++) {
+		if (tw->tw_count[i] > 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Put TO on the wheel, at the lowest level whose span covers it.
+ * Call with the wheel locked.
+ */
+static
+void
+timeoutwheel_insert(struct timeoutwheel *tw, struct timeout *to)
+{
+	struct timeout **slot;
+	uint64_t tick, delta;
+	unsigned level;
+
+	KASSERT(to->to_tick >= tw->tw_now);
+
+	tick = to->to_tick;
+	delta = tick - tw->tw_now;
+	for (level = 0; level < TIMEOUT_WHEEL_LEVELS - 1; level++) {
+		if (delta < LEVEL_SPAN(level + 1)) {
+			break;
+		}
+	}
+	if (delta >= WHEEL_SPAN) {
+		/* Too far out; park it in the last slot we can reach. */
+		tick = tw->tw_now + WHEEL_SPAN - 1;
+	}
+
+	slot = &tw->tw_slots[level][(tick >> LEVEL_SHIFT(level)) & WHEEL_MASK];
+	to->to_next = *slot;
+	to->to_prevp = slot;
+	if (*slot != NULL) {
+		(*slot)->to_prevp = &to->to_next;
+	}
+	*slot = to;
+	to->to_level = level;
+	to->to_wheel = tw;
+	tw->tw_count[level]++;
+}
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Take TO off the wheel. Call with the wheel locked.
  */
-static struct wchan *lbolt;
+static
+void
+timeoutwheel_remove(struct timeoutwheel *tw, struct timeout *to)
+{
+	KASSERT(to->to_wheel == tw);
+	KASSERT(tw->tw_count[to->to_level] > 0);
+
+	*to->to_prevp = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_prevp = to->to_prevp;
+	}
+	to->to_next = NULL;
+	to->to_prevp = NULL;
+	to->to_wheel = NULL;
+	tw->tw_count[to->to_level]--;
+}
 
 /*
- * Setup.
+ * The current slot at LEVEL has come up; move its timeouts down to
+ * where they now belong. Call with the wheel locked.
  */
+static
 void
-hardclock_bootstrap(void)
+timeoutwheel_cascade(struct timeoutwheel *tw, unsigned level)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	struct timeout **slot, *to;
+
+	slot = &tw->tw_slots[level][(tw->tw_now >> LEVEL_SHIFT(level))
+				    & WHEEL_MASK];
+	while ((to = *slot) != NULL) {
+		timeoutwheel_remove(tw, to);
+		timeoutwheel_insert(tw, to);
 	}
 }
 
+/*
+ * Return the first tick at which something on the wheel needs
+ * attention: either a timeout goes off, or a slot at a higher level
+ * needs to be cascaded. Call with the wheel locked.
+ */
+static
+uint64_t
+timeoutwheel_next(struct timeoutwheel *tw)
+{
+	uint64_t next, block;
+	unsigned level, i;
+
+	next = TIMEOUT_NEVER;
+	for (level = 0; level < TIMEOUT_WHEEL_LEVELS; level++) {
+		if (tw->tw_count[level] == 0) {
+			continue;
+		}
+		for (i=1; i<=TIMEOUT_WHEEL_SLOTS; i++) {
+			block = (tw->tw_now >> LEVEL_SHIFT(level)) + i;
+			if (tw->tw_slots[level][block & WHEEL_MASK] != NULL) {
+				block <<= LEVEL_SHIFT(level);
+				if (block < next) {
+					next = block;
+				}
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+/*
+ * Advance the wheel to NOW, calling everything that has gone off.
+ * Callbacks are called with the wheel unlocked, so they can set
+ * timeouts.
+ */
+static
+void
+timeoutwheel_run(struct timeoutwheel *tw, uint64_t now)
+{
+	struct timeout **slot, *to;
+	void (*func)(void *);
+	void *data;
+	uint64_t skip;
+	unsigned level;
+
+	spinlock_acquire(&tw->tw_lock);
+	while (tw->tw_now < now) {
+		if (tw->tw_count[0] == 0) {
+			/*
+			 * Nothing can go off before the next cascade
+			 * of the lowest occupied level; skip ahead to
+			 * it instead of stepping through empty slots.
+			 */
+			for (level = 1; level < TIMEOUT_WHEEL_LEVELS; level++) {
+				if (tw->tw_count[level] > 0) {
+					break;
+				}
+			}
+			if (level == TIMEOUT_WHEEL_LEVELS) {
+				tw->tw_now = now;
+				break;
+			}
+			skip = tw->tw_now | (LEVEL_SPAN(level) - 1);
+			if (skip >= now) {
+				tw->tw_now = now;
+				break;
+			}
+			tw->tw_now = skip;
+		}
+
+		tw->tw_now++;
+		for (level = TIMEOUT_WHEEL_LEVELS - 1; level > 0; level--) {
+			if ((tw->tw_now & (LEVEL_SPAN(level) - 1)) == 0) {
+				timeoutwheel_cascade(tw, level);
+			}
+		}
+
+		slot = &tw->tw_slots[0][tw->tw_now & WHEEL_MASK];
+		while ((to = *slot) != NULL) {
+			KASSERT(to->to_tick == tw->tw_now);
+			timeoutwheel_remove(tw, to);
+			func = to->to_func;
+			data = to->to_data;
+
+			spinlock_release(&tw->tw_lock);
+			func(data);
+			spinlock_acquire(&tw->tw_lock);
+		}
+	}
+	spinlock_release(&tw->tw_lock);
+}
+
+////////////////////////////////////////////////////////////
+// timer interrupt
+
+/*
+ * Program the current cpu's timer for the next hardclock or timeout,
+ * whichever is first. Interrupts must be off.
+ */
+static
+void
+clock_reprogram(uint64_t now)
+{
+	struct cpu *c = curcpu->c_self;
+	uint64_t next, delta;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	spinlock_acquire(&c->c_timeouts.tw_lock);
+	next = timeoutwheel_next(&c->c_timeouts);
+	spinlock_release(&c->c_timeouts.tw_lock);
+
+	if (c->c_ticking && c->c_nexthardclock < next) {
+		next = c->c_nexthardclock;
+	}
+	if (next == TIMEOUT_NEVER || next > now + CLOCK_MAXSLEEP) {
+		next = now + CLOCK_MAXSLEEP;
+	}
+	c->c_nextclockintr = next;
+
+	if (next <= now) {
+		mainbus_timer_set(TICK_USECS);
+	}
+	else {
+		delta = next - now;
+		mainbus_timer_set(delta * TICK_USECS);
+	}
+}
+
+/*
+ * Called from the platform code when the current cpu's timer goes
+ * off, with interrupts off.
+ */
+void
+clockintr(void)
+{
+	struct cpu *c = curcpu->c_self;
+	uint64_t now;
+	bool tick;
+
+	now = clock_ticks();
+	timeoutwheel_run(&c->c_timeouts, now);
+
+	tick = false;
+	if (c->c_ticking && now >= c->c_nexthardclock) {
+		c->c_nexthardclock = now + HARDCLOCK_TICKS;
+		tick = true;
+	}
+	clock_reprogram(now);
+
+	if (tick) {
+		hardclock();
+	}
+}
+
+////////////////////////////////////////////////////////////
+// timeouts
+
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *data)
+{
+	to->to_next = NULL;
+	to->to_prevp = NULL;
+	to->to_wheel = NULL;
+	to->to_level = 0;
+	to->to_tick = 0;
+	to->to_func = func;
+	to->to_data = data;
+}
+
+bool
+timeout_set(struct timeout *to, const struct timespec *when)
+{
+	struct timeoutwheel *tw;
+	uint64_t now, tick;
+	int spl;
+
+	KASSERT(when->tv_nsec >= 0 && when->tv_nsec < 1000000000);
+
+	timeout_cancel(to);
+
+	/* Round up, so we never go off early. */
+	tick = (uint64_t)when->tv_sec * TIMEOUT_HZ
+		+ (when->tv_nsec + TICK_NSECS - 1) / TICK_NSECS;
+
+	/* Stay on this cpu while we use its wheel and timer. */
+	spl = splhigh();
+
+	now = clock_ticks();
+	if (tick <= now) {
+		splx(spl);
+		return false;
+	}
+
+	tw = &curcpu->c_timeouts;
+	spinlock_acquire(&tw->tw_lock);
+	if (timeoutwheel_isempty(tw)) {
+		/* Nothing to process in between; catch the wheel up. */
+		tw->tw_now = now;
+	}
+	to->to_tick = tick;
+	timeoutwheel_insert(tw, to);
+	spinlock_release(&tw->tw_lock);
+
+	if (tick < curcpu->c_nextclockintr) {
+		clock_reprogram(now);
+	}
+
+	splx(spl);
+	return true;
+}
+
+bool
+timeout_cancel(struct timeout *to)
+{
+	struct timeoutwheel *tw;
+
+	tw = to->to_wheel;
+	if (tw == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&tw->tw_lock);
+	if (to->to_wheel != tw) {
+		/* It went off while we were getting the lock. */
+		spinlock_release(&tw->tw_lock);
+		return false;
+	}
+	timeoutwheel_remove(tw, to);
+	spinlock_release(&tw->tw_lock);
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// clocks
+
 /*
  * This is called once per second, on one processor, by the timer
- * code.
+ * code. (Not with options tickless.)
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	wchan_wakeall(lbolt);
+	/* Age the scheduler's cpu usage estimates */
+	schedcpu();
 }
 
 /*
@@ -92,25 +503,68 @@ hardclock(void)
 	 * Collect statistics here as desired.
 	 */
 
+	/* Interrupts are a quiescent state; see qsbr.h. */
+	qsbr_quiescent();
+
+	/* Charge the tick to the running thread, for the scheduler. */
+	if (!curcpu->c_isidle && curthread->t_cpuusage < SCHED_USAGE_MAX) {
+		curthread->t_cpuusage++;
+	}
+
 	curcpu->c_hardclocks++;
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
-	}
 	thread_yield();
 }
 
+/*
+ * Turn the hardclock on or off for the current cpu.
+ */
+void
+hardclock_start(void)
+{
+	struct cpu *c = curcpu->c_self;
+	uint64_t now;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	if (!c->c_ticking) {
+		now = clock_ticks();
+		c->c_ticking = true;
+		c->c_nexthardclock = now + HARDCLOCK_TICKS;
+		if (c->c_nexthardclock < c->c_nextclockintr) {
+			clock_reprogram(now);
+		}
+	}
+}
+
+void
+hardclock_stop(void)
+{
+#if OPT_TICKLESS
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	/*
+	 * Don't bother reprogramming the timer; if it goes off for
+	 * the hardclock we no longer want, clockintr() just sets it
+	 * for the next timeout instead.
+	 */
+	curcpu->c_ticking = false;
+#endif
+}
+
 /*
  * Suspend execution for n seconds.
  */
 void
 clocksleep(int num_secs)
 {
-	while (num_secs > 0) {
-		wchan_lock(lbolt);
-		wchan_sleep(lbolt);
-		num_secs--;
-	}
+	struct timespec when;
+	uint32_t nsecs;
+
+	gettime(&when.tv_sec, &nsecs);
+	when.tv_sec += num_secs;
+	when.tv_nsec = nsecs;
+	thread_sleep_until(&when);
 }
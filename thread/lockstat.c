@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+/* Length of names kept by lockstat_print */
+#define LOCKSTAT_NAMELEN 24
+
+/*
+ * All registered records. lockstat_lock is itself a spinlock, but
+ * it's never registered, so profiling doesn't recurse into it.
+ */
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+static struct lockstat *lockstat_list;
+
+/* Set once gettime works */
+static volatile bool lockstat_enabled;
+
+static const char *const lockstat_kinds[] = { "spin", "lock", "cv" };
+
+/*
+ * Start timing. Until now only registration happens.
+ */
+void
+lockstat_bootstrap(void)
+{
+	lockstat_enabled = true;
+}
+
+static
+uint64_t
+lockstat_gettime(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+void
+lockstat_init(struct lockstat *ls)
+{
+	ls->ls_name = NULL;
+	ls->ls_kind = LOCKSTAT_SPIN;
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waitnsecs = 0;
+	ls->ls_maxhold = 0;
+	ls->ls_holdstart = 0;
+	ls->ls_next = NULL;
+	ls->ls_prevp = NULL;
+}
+
+void
+lockstat_register(struct lockstat *ls, const char *name, unsigned kind)
+{
+	KASSERT(name != NULL);
+	KASSERT(ls->ls_prevp == NULL);
+
+	ls->ls_name = name;
+	ls->ls_kind = kind;
+
+	spinlock_acquire(&lockstat_lock);
+	ls->ls_next = lockstat_list;
+	if (lockstat_list != NULL) {
+		lockstat_list->ls_prevp = &ls->ls_next;
+	}
+	ls->ls_prevp = &lockstat_list;
+	lockstat_list = ls;
+	spinlock_release(&lockstat_lock);
+}
+
+void
+lockstat_unregister(struct lockstat *ls)
+{
+	if (ls->ls_prevp == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&lockstat_lock);
+	*ls->ls_prevp = ls->ls_next;
+	if (ls->ls_next != NULL) {
+		ls->ls_next->ls_prevp = ls->ls_prevp;
+	}
+	spinlock_release(&lockstat_lock);
+
+	ls->ls_next = NULL;
+	ls->ls_prevp = NULL;
+	ls->ls_name = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// hooks
+
+uint64_t
+lockstat_now(const struct lockstat *ls)
+{
+	if (ls->ls_name == NULL || !lockstat_enabled) {
+		return 0;
+	}
+	return lockstat_gettime();
+}
+
+void
+lockstat_acquired(struct lockstat *ls, uint64_t waitstart)
+{
+	uint64_t now;
+
+	if (ls->ls_name == NULL || !lockstat_enabled) {
+		return;
+	}
+
+	now = lockstat_gettime();
+	ls->ls_acquires++;
+	if (waitstart != 0) {
+		ls->ls_contended++;
+		ls->ls_waitnsecs += now - waitstart;
+	}
+	ls->ls_holdstart = now;
+}
+
+void
+lockstat_released(struct lockstat *ls)
+{
+	uint64_t held;
+
+	/* ls_holdstart is 0 if we started timing while it was held */
+	if (ls->ls_name == NULL || ls->ls_holdstart == 0) {
+		return;
+	}
+
+	held = lockstat_gettime() - ls->ls_holdstart;
+	if (held > ls->ls_maxhold) {
+		ls->ls_maxhold = held;
+	}
+	ls->ls_holdstart = 0;
+}
+
+void
+lockstat_waited(struct lockstat *ls, uint64_t waitstart)
+{
+	if (ls->ls_name == NULL || waitstart == 0) {
+		return;
+	}
+
+	ls->ls_acquires++;
+	ls->ls_contended++;
+	ls->ls_waitnsecs += lockstat_gettime() - waitstart;
+}
+
+////////////////////////////////////////////////////////////
+// reporting
+
+/*
+ * Copy of a record taken for printing, so we can print after letting
+ * go of lockstat_lock (kprintf may sleep) without caring whether the
+ * lock has been destroyed in the meantime.
+ */
+struct lockstat_snap {
+	char lss_name[LOCKSTAT_NAMELEN];
+	unsigned lss_kind;
+	unsigned lss_acquires;
+	unsigned lss_contended;
+	uint64_t lss_waitnsecs;
+	uint64_t lss_maxhold;
+};
+
+void
+lockstat_print(unsigned max)
+{
+	struct lockstat_snap *top;
+	struct lockstat *ls;
+	unsigned num, i;
+
+	if (max == 0) {
+		return;
+	}
+	top = kmalloc(max * sizeof(*top));
+	if (top == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	/* Keep TOP sorted by wait time, longest first. */
+	num = 0;
+	spinlock_acquire(&lockstat_lock);
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		if (ls->ls_acquires == 0) {
+			continue;
+		}
+		if (num == max &&
+		    ls->ls_waitnsecs <= top[max-1].lss_waitnsecs) {
+			continue;
+		}
+		i = (num < max) ? num++ : max-1;
+		while (i > 0 && top[i-1].lss_waitnsecs < ls->ls_waitnsecs) {
+			top[i] = top[i-1];
+			i--;
+		}
+		snprintf(top[i].lss_name, LOCKSTAT_NAMELEN, "%s", ls->ls_name);
+		top[i].lss_kind = ls->ls_kind;
+		top[i].lss_acquires = ls->ls_acquires;
+		top[i].lss_contended = ls->ls_contended;
+		top[i].lss_waitnsecs = ls->ls_waitnsecs;
+		top[i].lss_maxhold = ls->ls_maxhold;
+	}
+	spinlock_release(&lockstat_lock);
+
+	kprintf("kind %-23s %10s %10s %12s %10s\n", "name",
+		"acquires", "contended", "wait(us)", "hold(us)");
+	for (i=0; i<num; i++) {
+		kprintf("%-4s %-23s %10u %10u %12llu %10llu\n",
+			lockstat_kinds[top[i].lss_kind], top[i].lss_name,
+			top[i].lss_acquires, top[i].lss_contended,
+			top[i].lss_waitnsecs / 1000,
+			top[i].lss_maxhold / 1000);
+	}
+	kfree(top);
+}
+
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+
+	spinlock_acquire(&lockstat_lock);
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waitnsecs = 0;
+		ls->ls_maxhold = 0;
+	}
+	spinlock_release(&lockstat_lock);
+}
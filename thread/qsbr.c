@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Quiescent-state-based reclamation. See qsbr.h.
+ *
+ * Grace periods are numbered. qsbr_gp is the latest one started and
+ * qsbr_done the latest one finished; when they're equal nothing is
+ * in progress. While one is in progress, qsbr_pending has a bit for
+ * each cpu that hasn't yet reported a quiescent state for it; the
+ * cpu that clears the last bit ends the grace period, runs the
+ * callbacks that were waiting for it, wakes anyone sleeping in
+ * qsbr_synchronize, and starts the next grace period if somebody has
+ * already asked for it.
+ *
+ * A request made while a grace period is in progress has to wait for
+ * the *next* one, since cpus that reported before the request may
+ * since have entered a read section that can see the old object.
+ *
+ * The callbacks run after qsbr_lock is dropped, perhaps on several
+ * cpus at once, and the next grace period may already be under way
+ * (or even over) by then. qsbr_cbdone is the latest grace period
+ * whose callbacks have all finished: it catches up with qsbr_done
+ * whenever no cpu is still running a batch (qsbr_cbbusy). That's
+ * what qsbr_synchronize waits for, so that once it returns, any
+ * callbacks queued before it was called have run.
+ */
+
+#define QSBR_INLINE
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <wchan.h>
+#include <qsbr.h>
+
+/* Grace period A is the same as or later than B (allowing for wrap) */
+#define GP_GEQ(a, b) ((int)((a) - (b)) >= 0)
+
+static struct spinlock qsbr_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned qsbr_gp;	/* Latest grace period started */
+static volatile unsigned qsbr_done;	/* Latest grace period finished */
+static volatile unsigned qsbr_cbdone;	/* ...and its callbacks run */
+static unsigned qsbr_cbbusy;		/* Cpus running callbacks */
+static unsigned qsbr_want;		/* Latest grace period requested */
+static volatile cpumask_t qsbr_pending;	/* Cpus yet to report */
+static cpumask_t qsbr_online;		/* Cpus taking part */
+
+/* Callbacks, oldest (lowest qh_gp) first */
+static struct qsbr_head *qsbr_cbhead;
+static struct qsbr_head **qsbr_cbtail = &qsbr_cbhead;
+
+/* For qsbr_synchronize */
+static struct wchan *qsbr_wchan;
+
+/*
+ * Set up. Called from boot() once wait channels can be made, before
+ * anyone can call qsbr_synchronize.
+ */
+void
+qsbr_bootstrap(void)
+{
+	qsbr_wchan = wchan_create("qsbr");
+	if (qsbr_wchan == NULL) {
+		panic("qsbr_bootstrap: Out of memory\n");
+	}
+	qsbr_cpu_online();
+}
+
+/*
+ * Start counting the current cpu in grace periods. A cpu that comes
+ * online in the middle of one can't be holding anything from before
+ * it, so it needn't report for it.
+ */
+void
+qsbr_cpu_online(void)
+{
+	spinlock_acquire(&qsbr_lock);
+	qsbr_online |= CPUMASK_BIT(curcpu->c_number);
+	spinlock_release(&qsbr_lock);
+}
+
+/*
+ * Start grace period GP. Call with qsbr_lock held. The caller should
+ * send IPI_QSBR to the other cpus once it has dropped the lock.
+ */
+static
+void
+qsbr_start(unsigned gp)
+{
+	KASSERT(spinlock_do_i_hold(&qsbr_lock));
+	KASSERT(qsbr_gp == qsbr_done);
+
+	qsbr_gp = gp;
+	qsbr_pending = qsbr_online;
+}
+
+/*
+ * Ask for a grace period to start after now, and return its number.
+ * Call with qsbr_lock held; sets *START if the caller needs to send
+ * IPI_QSBR.
+ */
+static
+unsigned
+qsbr_request(bool *start)
+{
+	unsigned gp;
+
+	KASSERT(spinlock_do_i_hold(&qsbr_lock));
+
+	gp = qsbr_gp + 1;
+	if (qsbr_gp == qsbr_done) {
+		qsbr_start(gp);
+		*start = true;
+	}
+	if (GP_GEQ(gp, qsbr_want)) {
+		qsbr_want = gp;
+	}
+	return gp;
+}
+
+/*
+ * Record a quiescent state for the current cpu. Call with interrupts
+ * off and no spinlocks held: from thread_switch, idle, or an
+ * interrupt handler.
+ */
+void
+qsbr_quiescent(void)
+{
+	struct qsbr_head *done, *qh;
+	cpumask_t me;
+	bool ended = false, start = false, wake = false;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	me = CPUMASK_BIT(curcpu->c_number);
+
+	/* Unlocked peek for the common case of nothing to do. */
+	if (qsbr_gp == qsbr_done || (qsbr_pending & me) == 0) {
+		return;
+	}
+
+	spinlock_acquire(&qsbr_lock);
+	while (qsbr_gp != qsbr_done && (qsbr_pending & me) != 0) {
+		qsbr_pending &= ~me;
+		if (qsbr_pending != 0) {
+			break;
+		}
+		qsbr_done = qsbr_gp;
+		ended = true;
+		if (qsbr_want != qsbr_done) {
+			/* We're quiescent for this one too; go around. */
+			qsbr_start(qsbr_done + 1);
+			start = true;
+		}
+	}
+
+	/* Take the callbacks whose grace period has passed. */
+	done = NULL;
+	if (ended && qsbr_cbhead != NULL &&
+	    GP_GEQ(qsbr_done, qsbr_cbhead->qh_gp)) {
+		done = qsbr_cbhead;
+		qh = done;
+		while (qh->qh_next != NULL &&
+		       GP_GEQ(qsbr_done, qh->qh_next->qh_gp)) {
+			qh = qh->qh_next;
+		}
+		qsbr_cbhead = qh->qh_next;
+		if (qsbr_cbhead == NULL) {
+			qsbr_cbtail = &qsbr_cbhead;
+		}
+		qh->qh_next = NULL;
+	}
+	if (ended) {
+		qsbr_cbbusy++;
+	}
+	spinlock_release(&qsbr_lock);
+
+	if (start) {
+		ipi_broadcast(IPI_QSBR);
+	}
+
+	while (done != NULL) {
+		qh = done;
+		done = qh->qh_next;
+		qh->qh_func(qh->qh_arg);
+	}
+
+	if (ended) {
+		spinlock_acquire(&qsbr_lock);
+		KASSERT(qsbr_cbbusy > 0);
+		qsbr_cbbusy--;
+		if (qsbr_cbbusy == 0) {
+			/* Every batch taken so far has finished. */
+			qsbr_cbdone = qsbr_done;
+			wake = true;
+		}
+		spinlock_release(&qsbr_lock);
+		if (wake) {
+			wchan_wakeall(qsbr_wchan);
+		}
+	}
+}
+
+/*
+ * Arrange for FUNC(ARG) to be called once no read section that might
+ * have seen the object being released is still running. May be
+ * called from inside a read section. FUNC must not sleep.
+ */
+void
+qsbr_call(struct qsbr_head *qh, void (*func)(void *), void *arg)
+{
+	bool start = false;
+
+	qh->qh_next = NULL;
+	qh->qh_func = func;
+	qh->qh_arg = arg;
+
+	spinlock_acquire(&qsbr_lock);
+	qh->qh_gp = qsbr_request(&start);
+	*qsbr_cbtail = qh;
+	qsbr_cbtail = &qh->qh_next;
+	spinlock_release(&qsbr_lock);
+
+	if (start) {
+		ipi_broadcast(IPI_QSBR);
+	}
+}
+
+/*
+ * Wait until a full grace period has passed, and the callbacks for it
+ * (and any before it) have run. Must be called from thread context,
+ * outside any read section.
+ */
+void
+qsbr_synchronize(void)
+{
+	unsigned gp;
+	bool start = false;
+	int spl;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(curthread->t_curspl == 0);
+
+	spinlock_acquire(&qsbr_lock);
+	gp = qsbr_request(&start);
+	spinlock_release(&qsbr_lock);
+
+	if (start) {
+		ipi_broadcast(IPI_QSBR);
+	}
+
+	/* We aren't in a read section, so this cpu can report now. */
+	spl = splhigh();
+	qsbr_quiescent();
+	splx(spl);
+
+	wchan_lock(qsbr_wchan);
+	while (!GP_GEQ(qsbr_cbdone, gp)) {
+		wchan_sleep(qsbr_wchan);
+		wchan_lock(qsbr_wchan);
+	}
+	wchan_unlock(qsbr_wchan);
+}
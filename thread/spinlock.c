@@ -29,12 +29,15 @@
 
 /* Make sure to build out-of-line versions of spinlock inline functions */
 #define SPINLOCK_INLINE   /* empty */
+/* ...and of the atomic operations, which are much the same thing */
+#define ATOMIC_INLINE     /* empty */
 
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <machine/atomic.h>
 #include <current.h>	/* for curcpu */
 
 /*
@@ -50,6 +53,9 @@ spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lockstat_init(&lk->lk_stat);
+#endif
 }
 
 /*
@@ -60,6 +66,9 @@ spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
 	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+#if OPT_LOCKSTAT
+	lockstat_unregister(&lk->lk_stat);
+#endif
 }
 
 /*
@@ -73,6 +82,10 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+#if OPT_LOCKSTAT
+	uint64_t waitstart = 0;
+	bool waiting = false;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -99,6 +112,12 @@ spinlock_acquire(struct spinlock *lk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&lk->lk_lock) != 0) {
+#if OPT_LOCKSTAT
+			if (!waiting) {
+				waiting = true;
+				waitstart = lockstat_now(&lk->lk_stat);
+			}
+#endif
 			continue;
 		}
 		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
@@ -108,6 +127,9 @@ spinlock_acquire(struct spinlock *lk)
 	}
 
 	lk->lk_holder = mycpu;
+#if OPT_LOCKSTAT
+	lockstat_acquired(&lk->lk_stat, waitstart);
+#endif
 }
 
 /*
@@ -121,6 +143,9 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	lockstat_released(&lk->lk_stat);
+#endif
 	lk->lk_holder = NULL;
 	spinlock_data_set(&lk->lk_lock, 0);
 	spllower(IPL_HIGH, IPL_NONE);
@@ -70,6 +70,7 @@ sem_create(const char *name, int initial_count)
 	}
 
 	spinlock_init(&sem->sem_lock);
+	spinlock_setname(&sem->sem_lock, sem->sem_name);
         sem->sem_count = initial_count;
 
         return sem;
@@ -173,8 +174,16 @@ lock_create(const char *name)
         }
 
         spinlock_init(&lock->lk_lock);
+        spinlock_setname(&lock->lk_lock, lock->lk_name);
         lock->lk_thread = NULL;
         lock->lk_count = 1;
+        lock->lk_waiters = 0;
+        lock->lk_piwaiters = NULL;
+        lock->lk_heldnext = NULL;
+#if OPT_LOCKSTAT
+        lockstat_init(&lock->lk_stat);
+        lockstat_register(&lock->lk_stat, lock->lk_name, LOCKSTAT_LOCK);
+#endif
 
         //
 
@@ -187,7 +196,12 @@ lock_destroy(struct lock *lock)
         KASSERT(lock != NULL);
 
         // add stuff here as needed
+        KASSERT(lock->lk_thread == NULL);
+        KASSERT(lock->lk_piwaiters == NULL);
 
+#if OPT_LOCKSTAT
+        lockstat_unregister(&lock->lk_stat);
+#endif
         spinlock_cleanup(&lock->lk_lock);
         wchan_destroy(lock->lk_wchan);        
         
@@ -197,26 +211,212 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Priority inheritance.
+ *
+ * A thread that goes to sleep on a lock lends its priority to the
+ * holder, and if the holder is itself asleep on a lock, to that
+ * lock's holder, and so on down the chain. A thread gives back what
+ * it borrowed when it releases a lock with waiters, by working out
+ * afresh what it's owed by the waiters on the locks it still holds.
+ *
+ * pi_lock protects the lk_piwaiters lists, t_blockedon, and (while
+ * there are waiters) lk_thread, so the chain can be followed without
+ * taking every lock's lk_lock. It comes after lk_lock and before the
+ * run queue locks. Each thread's t_heldlocks list is only touched by
+ * that thread. Locks without sleepers never take pi_lock.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * The priority a thread lends: the better of its own and what it's
+ * been lent.
+ */
+static
+int
+pi_threadpri(struct thread *t)
+{
+        return t->t_priority < t->t_inheritpri ?
+                t->t_priority : t->t_inheritpri;
+}
+
+/*
+ * Record that curthread is about to sleep on LOCK, and lend its
+ * priority down the chain. Call with lk_lock held; may be called
+ * again each time round if we wake and lose the lock again.
+ */
+static
+void
+pi_block(struct lock *lock)
+{
+        struct thread *holder;
+        int pri;
+
+        spinlock_acquire(&pi_lock);
+        if(curthread->t_blockedon == NULL){
+          curthread->t_blockedon = lock;
+          curthread->t_piwaitnext = lock->lk_piwaiters;
+          lock->lk_piwaiters = curthread;
+        }
+        KASSERT(curthread->t_blockedon == lock);
+
+        // Stops at a thread that already has this priority or
+        // better, so a deadlock cycle doesn't loop forever.
+        pri = pi_threadpri(curthread);
+        while(lock != NULL){
+          holder = lock->lk_thread;
+          if(holder == NULL || holder->t_inheritpri <= pri){
+            break;
+          }
+          thread_setinheritpri(holder, pri);
+          lock = holder->t_blockedon;
+        }
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * Work out what curthread is owed by the waiters on the locks it
+ * holds. Call with pi_lock held.
+ */
+static
+void
+pi_recompute(void)
+{
+        struct lock *lk;
+        struct thread *t;
+        int pri, best;
+
+        best = THREAD_PRI_MAX;
+        for(lk = curthread->t_heldlocks; lk != NULL; lk = lk->lk_heldnext){
+          for(t = lk->lk_piwaiters; t != NULL; t = t->t_piwaitnext){
+            pri = pi_threadpri(t);
+            if(pri < best){
+              best = pri;
+            }
+          }
+        }
+        if(best != curthread->t_inheritpri){
+          thread_setinheritpri(curthread, best);
+        }
+}
+
+/*
+ * Take ownership of LOCK, which has sleepers (maybe including us).
+ * Call with lk_lock held and after adding LOCK to t_heldlocks.
+ */
+static
+void
+pi_acquired(struct lock *lock)
+{
+        struct thread **tp;
+
+        spinlock_acquire(&pi_lock);
+        if(curthread->t_blockedon != NULL){
+          KASSERT(curthread->t_blockedon == lock);
+          for(tp = &lock->lk_piwaiters; *tp != curthread;
+              tp = &(*tp)->t_piwaitnext){
+            KASSERT(*tp != NULL);
+          }
+          *tp = curthread->t_piwaitnext;
+          curthread->t_piwaitnext = NULL;
+          curthread->t_blockedon = NULL;
+        }
+        lock->lk_thread = curthread;
+        pi_recompute();
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * Give up LOCK, which has sleepers, and whatever priority they lent
+ * us. Call with lk_lock held and after removing LOCK from t_heldlocks.
+ */
+static
+void
+pi_released(struct lock *lock)
+{
+        spinlock_acquire(&pi_lock);
+        lock->lk_thread = NULL;
+        pi_recompute();
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * Adaptive spinning. While the holder is running on another cpu we
+ * spin, in chunks of LOCK_SPIN_CHUNK polls of lk_count, rechecking
+ * the holder with lk_lock held between chunks, for up to
+ * LOCK_SPIN_MAX polls in all. A context switch costs a good deal
+ * more than that.
+ */
+#define LOCK_SPIN_CHUNK 64
+#define LOCK_SPIN_MAX   1024
+
+/*
+ * Check if the holder of a lock is running on some other cpu. This is
+ * only a hint. Call with lk_lock held, so the holder can't go away.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+        struct thread *holder = lock->lk_thread;
+
+        return holder != NULL && holder->t_state == S_RUN &&
+                holder->t_cpu != curthread->t_cpu;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+        unsigned spins, i;
+#if OPT_LOCKSTAT
+        uint64_t waitstart = 0;
+#endif
+
         // Write this
         KASSERT(lock != NULL);
         KASSERT(curthread->t_in_interrupt == false);
         KASSERT(!lock_do_i_hold(lock));
 
+        spins = 0;
         spinlock_acquire(&lock->lk_lock);
-        
+
+#if OPT_LOCKSTAT
+        if(lock->lk_count == 0){
+          waitstart = lockstat_now(&lock->lk_stat);
+        }
+#endif
         while(lock->lk_count == 0){
+          if(spins < LOCK_SPIN_MAX && lock_holder_running(lock)){
+            spinlock_release(&lock->lk_lock);
+            for(i=0; i<LOCK_SPIN_CHUNK && lock->lk_count == 0; i++){
+              /* spin */
+            }
+            spins += LOCK_SPIN_CHUNK;
+            spinlock_acquire(&lock->lk_lock);
+            continue;
+          }
+          lock->lk_waiters++;
+          pi_block(lock);
           wchan_lock(lock->lk_wchan);
           spinlock_release(&lock->lk_lock);
           wchan_sleep(lock->lk_wchan);
           spinlock_acquire(&lock->lk_lock);
+          lock->lk_waiters--;
         }
         
         KASSERT(lock->lk_count == 1);
-        lock->lk_thread = curthread;
         lock->lk_count --;
+        lock->lk_heldnext = curthread->t_heldlocks;
+        curthread->t_heldlocks = lock;
+        if(lock->lk_piwaiters != NULL){
+          pi_acquired(lock);
+        }
+        else {
+          lock->lk_thread = curthread;
+        }
+#if OPT_LOCKSTAT
+        lockstat_acquired(&lock->lk_stat, waitstart);
+#endif
         spinlock_release(&lock->lk_lock);
 
         //
@@ -226,17 +426,36 @@ lock_acquire(struct lock *lock)
 void
 lock_release(struct lock *lock)
 {
+        struct lock **lp;
+
         // Write this
         KASSERT(lock != NULL);
         KASSERT(lock_do_i_hold(lock));
 
         spinlock_acquire(&lock->lk_lock);
 
+#if OPT_LOCKSTAT
+        lockstat_released(&lock->lk_stat);
+#endif
         lock->lk_count ++;
         KASSERT(lock->lk_count == 1);
-        wchan_wakeone(lock->lk_wchan);
+        if(lock->lk_waiters > 0){
+          wchan_wakeone(lock->lk_wchan);
+        }
 
-        lock->lk_thread = NULL;
+        // Usually the most recently acquired, so at the head
+        for(lp = &curthread->t_heldlocks; *lp != lock; lp = &(*lp)->lk_heldnext){
+          KASSERT(*lp != NULL);
+        }
+        *lp = lock->lk_heldnext;
+        lock->lk_heldnext = NULL;
+
+        if(lock->lk_piwaiters != NULL){
+          pi_released(lock);
+        }
+        else {
+          lock->lk_thread = NULL;
+        }
         spinlock_release(&lock->lk_lock);
 
         //
@@ -291,6 +510,10 @@ cv_create(const char *name)
                 kfree(cv);
                 return NULL;
         }
+#if OPT_LOCKSTAT
+        lockstat_init(&cv->cv_stat);
+        lockstat_register(&cv->cv_stat, cv->cv_name, LOCKSTAT_CV);
+#endif
 
         //
         return cv;
@@ -302,6 +525,9 @@ cv_destroy(struct cv *cv)
         KASSERT(cv != NULL);
 
         // add stuff here as needed
+#if OPT_LOCKSTAT
+        lockstat_unregister(&cv->cv_stat);
+#endif
         wchan_destroy(cv->cv_wchan);
 
         //
@@ -312,15 +538,26 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+#if OPT_LOCKSTAT
+        uint64_t waitstart;
+#endif
+
         // Write this
         KASSERT(cv != NULL);
         KASSERT(lock != NULL);
         KASSERT(lock_do_i_hold(lock));
+#if OPT_LOCKSTAT
+        waitstart = lockstat_now(&cv->cv_stat);
+#endif
         
         wchan_lock(cv->cv_wchan);
         lock_release(lock);
         wchan_sleep(cv->cv_wchan);
         lock_acquire(lock);
+#if OPT_LOCKSTAT
+        /* Counted with LOCK held, which serializes the counters. */
+        lockstat_waited(&cv->cv_stat, waitstart);
+#endif
 
         //
         //(void)cv;    // suppress warning until code gets written
@@ -356,3 +593,174 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	//(void)cv;    // suppress warning until code gets written
 	//(void)lock;  // suppress warning until code gets written
 }
+
+////////////////////////////////////////////////////////////
+//
+// RW lock
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_rwchan = wchan_create(rw->rw_name);
+        if (rw->rw_rwchan == NULL) {
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_wwchan = wchan_create(rw->rw_name);
+        if (rw->rw_wwchan == NULL) {
+                wchan_destroy(rw->rw_rwchan);
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_lock);
+        spinlock_setname(&rw->rw_lock, rw->rw_name);
+        rw->rw_readers = 0;
+        rw->rw_waitwriters = 0;
+        rw->rw_writer = NULL;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+
+        spinlock_cleanup(&rw->rw_lock);
+        wchan_destroy(rw->rw_wwchan);
+        wchan_destroy(rw->rw_rwchan);
+
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+
+        /* wait behind writers, including waiting ones */
+        while(rw->rw_writer != NULL || rw->rw_waitwriters > 0){
+          wchan_lock(rw->rw_rwchan);
+          spinlock_release(&rw->rw_lock);
+          wchan_sleep(rw->rw_rwchan);
+          spinlock_acquire(&rw->rw_lock);
+        }
+
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_lock);
+
+        KASSERT(rw->rw_readers > 0);
+        rw->rw_readers--;
+        if(rw->rw_readers == 0 && rw->rw_waitwriters > 0){
+          wchan_wakeone(rw->rw_wwchan);
+        }
+
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+
+        while(rw->rw_writer != NULL || rw->rw_readers > 0){
+          rw->rw_waitwriters++;
+          wchan_lock(rw->rw_wwchan);
+          spinlock_release(&rw->rw_lock);
+          wchan_sleep(rw->rw_wwchan);
+          spinlock_acquire(&rw->rw_lock);
+          rw->rw_waitwriters--;
+        }
+
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+}
+
+/*
+ * Wake up whoever should go next after a writer lets go: another
+ * writer if there is one, otherwise all the readers. Call with
+ * rw_lock held.
+ */
+static
+void
+rwlock_wake(struct rwlock *rw)
+{
+        if(rw->rw_waitwriters > 0){
+          wchan_wakeone(rw->rw_wwchan);
+        }
+        else {
+          wchan_wakeall(rw->rw_rwchan);
+        }
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rwlock_do_i_hold_write(rw));
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writer = NULL;
+        rwlock_wake(rw);
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_downgrade(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rwlock_do_i_hold_write(rw));
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writer = NULL;
+        rw->rw_readers++;
+        /* other readers can join us, unless a writer is waiting */
+        if(rw->rw_waitwriters == 0){
+          wchan_wakeall(rw->rw_rwchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        return rw->rw_writer == curthread;
+}
@@ -35,23 +35,32 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <machine/atomic.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
 #include <proc.h>
 #include <current.h>
+#include <clock.h>
+#include <timeout.h>
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <qsbr.h>
+#include <syscall.h>
 
+#include "opt-A2.h"
 #include "opt-synchprobs.h"
+#include "opt-tickless.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -72,6 +81,17 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Scheduler epoch, in seconds; updated by schedcpu(). */
+static volatile unsigned sched_epoch;
+
+/*
+ * The cpus in each processor set. Changed only under pset_lock; read
+ * without it by the scheduler, which copes with a cpu briefly being
+ * in no set or in two.
+ */
+static struct spinlock pset_lock = SPINLOCK_INITIALIZER;
+static volatile cpumask_t pset_cpus[PSET_MAX];
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -111,6 +131,51 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Initialize the fields of a new or recycled thread, other than its
+ * name and stack.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
+	thread->t_wchan_name = "NEW";
+	thread->t_state = S_READY;
+
+	/* Thread subsystem fields */
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_context = NULL;
+	thread->t_cpu = NULL;
+	thread->t_prevcpu = NULL;
+	thread->t_inboxnext = NULL;
+	thread->t_proc = NULL;
+
+	/* Interrupt state fields */
+	thread->t_in_interrupt = false;
+	thread->t_curspl = IPL_HIGH;
+	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+
+	/* Scheduler fields */
+	thread->t_nice = 0;
+	thread->t_priority = THREAD_PRI_DEFAULT;
+	thread->t_inheritpri = THREAD_PRI_MAX;
+	thread->t_blockedon = NULL;
+	thread->t_piwaitnext = NULL;
+	thread->t_heldlocks = NULL;
+	thread->t_cpuusage = 0;
+	thread->t_schedepoch = sched_epoch;
+	thread->t_affinity = CPUMASK_ALL;
+	thread->t_pset = PSET_DEFAULT;
+
+	/* Accounting fields */
+	bzero(&thread->t_usage, sizeof(thread->t_usage));
+	seqlock_init(&thread->t_usagelock);
+	thread->t_usagestamp = 0;
+
+	/* If you add to struct thread, be sure to initialize here */
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -133,27 +198,107 @@ thread_create(const char *name)
 		kfree(thread);
 		return NULL;
 	}
-	thread->t_wchan_name = "NEW";
-	thread->t_state = S_READY;
-
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
 	thread->t_stack = NULL;
-	thread->t_context = NULL;
-	thread->t_cpu = NULL;
-	thread->t_proc = NULL;
+	thread_init(thread);
 
-	/* Interrupt state fields */
-	thread->t_in_interrupt = false;
-	thread->t_curspl = IPL_HIGH;
-	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+	return thread;
+}
 
-	/* If you add to struct thread, be sure to initialize here */
+/*
+ * Thread recycling.
+ *
+ * Instead of destroying dead threads that have a stack, exorcise()
+ * keeps up to THREAD_POOL_MAX of them in a per-cpu pool, and
+ * thread_fork takes them back out, saving the kmallocs and kfrees
+ * of the thread, its stack, and usually its name. The pool is
+ * accessed only by its own cpu, with interrupts off.
+ */
+#define THREAD_POOL_MAX 16
+
+/*
+ * Put a zombie in the current cpu's pool. Returns false if it can't
+ * be pooled, in which case it should be destroyed.
+ */
+static
+bool
+thread_pool_put(struct thread *thread)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(thread != curthread);
+	KASSERT(thread->t_state == S_ZOMBIE);
+	KASSERT(thread->t_proc == NULL);
+
+	if (thread->t_stack == NULL ||
+	    curcpu->c_threadpool.tl_count >= THREAD_POOL_MAX) {
+		return false;
+	}
+
+	thread_checkstack(thread);
+	thread_machdep_cleanup(&thread->t_machdep);
+	thread->t_wchan_name = "POOLED";
+	threadlist_addtail(&curcpu->c_threadpool, thread);
+	return true;
+}
+
+/*
+ * Get a thread, with stack, from the current cpu's pool, and rename
+ * it to NAME. The old name is reused if the new one fits. Returns
+ * NULL if the pool is empty (or we run out of memory renaming).
+ */
+static
+struct thread *
+thread_pool_get(const char *name)
+{
+	struct thread *thread;
+	char *newname;
+	int spl;
 
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadpool);
+	splx(spl);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (strlen(name) <= strlen(thread->t_name)) {
+		strcpy(thread->t_name, name);
+	}
+	else {
+		newname = kstrdup(name);
+		if (newname == NULL) {
+			spl = splhigh();
+			threadlist_addhead(&curcpu->c_threadpool, thread);
+			splx(spl);
+			return NULL;
+		}
+		kfree(thread->t_name);
+		thread->t_name = newname;
+	}
+
+	thread_init(thread);
 	return thread;
 }
 
+/*
+ * Each cpu's evictor thread. thread_switch switches to it when the
+ * current thread may no longer run here and there's nothing else to
+ * run, since the thread can't be sent elsewhere while we're still on
+ * its stack; the evictor sends it (see evict) and idles in its place.
+ * It's never on a run queue: when it yields, thread_switch just
+ * leaves it until it's needed again.
+ */
+static
+void
+cpu_evictor(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		thread_yield();
+	}
+}
+
 /*
  * Create a CPU structure. This is used for the bootup CPU and
  * also for secondary CPUs.
@@ -179,11 +324,22 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadpool);
 	c->c_hardclocks = 0;
+	c->c_evicted = NULL;
+	c->c_ticking = true;
+	c->c_nexthardclock = 0;
+	c->c_nextclockintr = TIMEOUT_NEVER;
+	c->c_clocksecs = 0;
+	c->c_clocknsecs = 0;
+	c->c_clockcycles = 0;
+	timeoutwheel_init(&c->c_timeouts);
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	c->c_inbox = NULL;
+	spinlock_setname(&c->c_runqueue_lock, "runqueue");
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -193,6 +349,15 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	if (c->c_number >= CPUMASK_MAXCPUS) {
+		panic("cpu_create: Too many cpus\n");
+	}
+	pset_cpus[PSET_DEFAULT] |= CPUMASK_BIT(c->c_number);
+
+	result = syscall_cpuinit(c->c_number);
+	if (result != 0) {
+		panic("cpu_create: syscall_cpuinit: %s\n", strerror(result));
+	}
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -222,6 +387,25 @@ cpu_create(unsigned hardware_number)
 	}
 	c->c_curthread->t_cpu = c;
 
+	snprintf(namebuf, sizeof(namebuf), "<evictor #%d>", c->c_number);
+	c->c_evictor = thread_create(namebuf);
+	if (c->c_evictor == NULL) {
+		panic("cpu_create: thread_create failed\n");
+	}
+	c->c_evictor->t_stack = kmalloc(STACK_SIZE);
+	if (c->c_evictor->t_stack == NULL) {
+		panic("cpu_create: couldn't allocate stack");
+	}
+	thread_checkstack_init(c->c_evictor);
+	c->c_evictor->t_cpu = c;
+	result = proc_addthread(kproc, c->c_evictor);
+	if (result) {
+		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
+	}
+	/* it comes out holding the run queue lock; see thread_fork */
+	c->c_evictor->t_iplhigh_count++;
+	switchframe_init(c->c_evictor, cpu_evictor, NULL, 0);
+
 	cpu_machdep_init(c);
 
 	return c;
@@ -254,6 +438,7 @@ thread_destroy(struct thread *thread)
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
+	seqlock_cleanup(&thread->t_usagelock);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
@@ -277,7 +462,9 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_pool_put(z)) {
+			thread_destroy(z);
+		}
 	}
 }
 
@@ -402,6 +589,7 @@ cpu_hatch(unsigned software_number)
 
 	kprintf("cpu%u: %s\n", software_number, cpu_identify());
 
+	qsbr_cpu_online();
 	V(cpu_startup_sem);
 	thread_exit();
 }
@@ -426,10 +614,460 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Recompute a thread's priority from its nice value and its recent
+ * cpu usage, and any priority it's inheriting. The usage is halved
+ * for every second (schedcpu() epoch) since it was last decayed;
+ * doing this lazily means sleeping threads get credit for the time
+ * they spent asleep without anyone having to go find them.
+ *
+ * The thread must not be running on another cpu.
+ */
+static
+void
+thread_updatepri(struct thread *t)
+{
+	unsigned epochs;
+	int pri;
+
+	epochs = sched_epoch - t->t_schedepoch;
+	if (epochs > 0) {
+		if (epochs >= 8 * sizeof(t->t_cpuusage)) {
+			t->t_cpuusage = 0;
+		}
+		else {
+			t->t_cpuusage >>= epochs;
+		}
+		t->t_schedepoch += epochs;
+	}
+
+	pri = THREAD_PRI_DEFAULT + t->t_nice
+		+ t->t_cpuusage / SCHED_USAGE_PER_PRI;
+	if (pri < THREAD_PRI_MIN) {
+		pri = THREAD_PRI_MIN;
+	}
+	if (pri > THREAD_PRI_MAX) {
+		pri = THREAD_PRI_MAX;
+	}
+	if (pri > t->t_inheritpri) {
+		pri = t->t_inheritpri;
+	}
+	t->t_priority = pri;
+}
+
+/*
+ * Put a thread on a cpu's run queue. The run queue is kept sorted by
+ * priority, best first, and threads of equal priority are kept in
+ * FIFO order so they still round-robin among themselves. Searching
+ * from the tail is cheapest in the common case, where most threads
+ * have the same priority.
+ *
+ * The run queue must be locked.
+ */
+static
+void
+thread_runqueue_insert(struct cpu *c, struct thread *t)
+{
+	struct thread *t2;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	THREADLIST_FORALL_REV(t2, c->c_runqueue) {
+		if (t2->t_priority <= t->t_priority) {
+			threadlist_insertafter(&c->c_runqueue, t2, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
+/*
+ * Return the set of cpus T may run on: those in both its affinity
+ * mask and its processor set. If that's empty because the set has
+ * lost its cpus, fall back to the default set.
+ */
+static
+cpumask_t
+thread_cpumask(struct thread *t)
+{
+	cpumask_t mask;
+
+	mask = t->t_affinity & pset_cpus[t->t_pset];
+	if (mask == 0) {
+		mask = t->t_affinity & pset_cpus[PSET_DEFAULT];
+	}
+	if (mask == 0) {
+		mask = pset_cpus[PSET_DEFAULT];
+	}
+	return mask;
+}
+
+static
+bool
+thread_cpu_ok(struct thread *t, struct cpu *c)
+{
+	return (thread_cpumask(t) & CPUMASK_BIT(c->c_number)) != 0;
+}
+
+/*
+ * Choose a cpu for T, which isn't allowed on the one it's on: the
+ * allowed cpu with the fewest threads waiting, preferring idle ones.
+ * The counts are read without locking; they're only a hint.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	cpumask_t mask;
+	unsigned i, numcpus, load, best_load;
+	struct cpu *c, *best;
+
+	mask = thread_cpumask(t);
+	best = NULL;
+	best_load = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		if ((mask & CPUMASK_BIT(i)) == 0) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+		load = c->c_runqueue.tl_count + (c->c_isidle ? 0 : 1);
+		if (best == NULL || load < best_load) {
+			best = c;
+			best_load = load;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Thread migration.
+ *
+ * Load balancing is done by work stealing: when a CPU runs out of
+ * things to do, just before it would go idle in thread_switch(), it
+ * goes looking for another CPU with threads waiting and takes one.
+ * Busy CPUs never have to look at anyone else's run queue, and an
+ * idle CPU picks up work as soon as it is available rather than at
+ * the next periodic balancing pass.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU,
+ * which is fairly slow. So when choosing what to steal we prefer a
+ * thread that was itself recently stolen away from the thief, since
+ * that thread may still have state in the thief's cache. Otherwise
+ * we take the thread at the tail of the queue, which is the one that
+ * would wait longest where it is.
+ *
+ * (System/161 does not (yet) model such cache effects, so this is
+ * mostly for form's sake.)
+ */
+
+/* How far into a victim's run queue to look for a cache-warm thread. */
+#define STEAL_SCAN_MAX 8
+
+/*
+ * Try to take a thread from some other CPU's run queue, for the
+ * current CPU to run. Returns NULL if there's nothing worth stealing.
+ *
+ * Must be called with interrupts off and *without* holding our own
+ * run queue lock, so two CPUs stealing from each other can't
+ * deadlock.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	unsigned i, numcpus, count, best_count;
+	struct cpu *c, *victim;
+	struct thread *t, *pick;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(!spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	/*
+	 * Pick the CPU with the most threads waiting. The counts are
+	 * read without locking; they're only a hint, and we check
+	 * again below once we have the victim locked.
+	 */
+	victim = NULL;
+	best_count = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (curcpu->c_number + i) % numcpus);
+		count = c->c_runqueue.tl_count;
+		if (count > best_count) {
+			victim = c;
+			best_count = count;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+
+	/*
+	 * If the victim is idle, it's about to run what it has
+	 * itself; don't fight it for a single thread.
+	 */
+	if (victim->c_isidle && victim->c_runqueue.tl_count < 2) {
+		spinlock_release(&victim->c_runqueue_lock);
+		return NULL;
+	}
+
+	pick = NULL;
+	i = 0;
+	THREADLIST_FORALL_REV(t, victim->c_runqueue) {
+		if (i++ >= STEAL_SCAN_MAX) {
+			break;
+		}
+		/*
+		 * The victim's curthread can appear on its run queue
+		 * if it went to sleep, the victim went idle, and then
+		 * it was woken again before the victim unidled. It
+		 * can't be migrated; see thread_switch.
+		 */
+		if (t == victim->c_curthread) {
+			continue;
+		}
+		if (!thread_cpu_ok(t, curcpu->c_self)) {
+			continue;
+		}
+		if (pick == NULL) {
+			pick = t;
+		}
+		if (t->t_prevcpu == curcpu->c_self) {
+			pick = t;
+			break;
+		}
+	}
+	if (pick != NULL) {
+		threadlist_remove(&victim->c_runqueue, pick);
+		pick->t_prevcpu = victim;
+		pick->t_cpu = curcpu->c_self;
+		DEBUG(DB_THREADS,
+		      "Stole thread %s: cpu %u -> %u\n",
+		      pick->t_name, victim->c_number, curcpu->c_number);
+	}
+
+	spinlock_release(&victim->c_runqueue_lock);
+	return pick;
+}
+
+/*
+ * Called when BUSY, which is not idle, has just had a thread added to
+ * its run queue. If that leaves threads waiting, poke an idle CPU so
+ * it comes and steals one. Otherwise an idle CPU would not notice
+ * until its next timer interrupt.
+ *
+ * As in thread_steal, the idle flags are read without locking; at
+ * worst we send an unnecessary IPI or miss a chance to send one.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+	cpumask_t mask;
+
+	if (busy->c_runqueue.tl_count < 2) {
+		return;
+	}
+
+	/* Only poke a cpu that can take the thread it would steal. */
+	mask = thread_cpumask(busy->c_runqueue.tl_tail.tln_prev->tln_self);
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (busy->c_number + i) % numcpus);
+		if ((mask & CPUMASK_BIT(c->c_number)) != 0 &&
+		    c->c_isidle &&
+		    (c->c_ipi_pending & (1U << IPI_UNIDLE)) == 0) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Lock the run queue of the cpu TARGET should be queued on, and
+ * return that cpu. This is normally target->t_cpu; but if the thread
+ * isn't allowed there any more it's sent elsewhere, unless it's
+ * still that cpu's curthread (see thread_steal), in which case it
+ * gets moved at its next context switch instead.
+ */
+static
+struct cpu *
+thread_runqueue_lock(struct thread *target)
+{
+	struct cpu *targetcpu;
+
+	targetcpu = target->t_cpu;
+	spinlock_acquire(&targetcpu->c_runqueue_lock);
+
+	if (!thread_cpu_ok(target, targetcpu) &&
+	    targetcpu->c_curthread != target) {
+		spinlock_release(&targetcpu->c_runqueue_lock);
+		targetcpu = thread_pickcpu(target);
+		target->t_cpu = targetcpu;
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	}
+	return targetcpu;
+}
+
+/*
+ * Having queued one or more threads on TARGETCPU, whose run queue is
+ * locked, make sure somebody notices. WASIDLE is whether it was idle
+ * before we started queueing.
+ */
+static
+void
+thread_runqueue_notify(struct cpu *targetcpu, bool wasidle)
+{
+	KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+
+	if (wasidle) {
+		/*
+		 * Other processor is idle; send interrupt to make
+		 * sure it unidles.
+		 */
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+	else {
+		if (!targetcpu->c_ticking) {
+			/*
+			 * Tickless: the target cpu now has somebody
+			 * to preempt for, so it needs its timer.
+			 */
+			if (targetcpu == curcpu->c_self) {
+				hardclock_start();
+			}
+			else {
+				ipi_send(targetcpu, IPI_UNIDLE);
+			}
+		}
+		thread_kick_idle(targetcpu);
+	}
+}
+
+/*
+ * Remote wakeups.
+ *
+ * Waking a thread that belongs to another cpu doesn't touch that
+ * cpu's run queue or its lock. Instead the thread is pushed onto the
+ * cpu's inbox, a lock-free stack, and the cpu moves everything in
+ * its inbox to its run queue itself whenever it looks at the run
+ * queue in thread_switch. Only the owner takes things off, and it
+ * takes the whole stack at once, so a compare-and-swap push is safe.
+ *
+ * The waker has to make sure the cpu looks soon. If it's idle, or is
+ * running tickless (so it has no timer to get it back into
+ * thread_switch), it gets IPI_UNIDLE. The flags are read without
+ * locking: the cpu sets them *before* its last look at the inbox,
+ * and we push *before* reading them, so one side or the other
+ * notices. (See also thread_hardclock_update.)
+ */
+
+/*
+ * Push the threads FIRST...LAST, already linked through t_inboxnext,
+ * onto C's inbox, and make sure C notices.
+ */
+static
+void
+thread_inbox_push(struct cpu *c, struct thread *first, struct thread *last)
+{
+	struct thread *old;
+
+	do {
+		old = c->c_inbox;
+		last->t_inboxnext = old;
+	} while (atomic_cas_ptr((void *volatile *)&c->c_inbox,
+				old, first) != old);
+
+	if (c->c_isidle || !c->c_ticking) {
+		ipi_send(c, IPI_UNIDLE);
+	}
+}
+
+/*
+ * Move everything in our inbox to the run queue, which must be locked.
+ */
+static
+void
+thread_inbox_drain(void)
+{
+	struct thread *t, *next, *fifo;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (curcpu->c_inbox == NULL) {
+		return;
+	}
+	t = atomic_swap_ptr((void *volatile *)&curcpu->c_inbox, NULL);
+
+	/* It's a stack; turn it around so wakeups stay in order. */
+	fifo = NULL;
+	while (t != NULL) {
+		next = t->t_inboxnext;
+		t->t_inboxnext = fifo;
+		fifo = t;
+		t = next;
+	}
+
+	while (fifo != NULL) {
+		t = fifo;
+		fifo = t->t_inboxnext;
+		t->t_inboxnext = NULL;
+		thread_runqueue_insert(curcpu->c_self, t);
+	}
+
+	/* If we got more than we can run, let an idle cpu have some. */
+	if (!curcpu->c_isidle) {
+		thread_kick_idle(curcpu->c_self);
+	}
+}
+
+/*
+ * Turn the hardclock on if we have somebody to preempt for, and off
+ * (options tickless) if not. Call with the run queue locked, after
+ * draining the inbox. The inbox is checked again after c_ticking
+ * goes false, in case a waker pushed a thread after we drained and
+ * then saw c_ticking still true.
+ */
+static
+void
+thread_hardclock_update(void)
+{
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (threadlist_isempty(&curcpu->c_runqueue)) {
+		hardclock_stop();
+		if (curcpu->c_inbox == NULL) {
+			return;
+		}
+	}
+	hardclock_start();
+}
+
+/*
+ * Check whether T can be woken through the inbox of its cpu: it has
+ * to be another cpu, and one T is still allowed on. (If T isn't, it
+ * needs sending elsewhere; thread_runqueue_lock does that.)
+ */
+static
+bool
+thread_wake_remote(struct thread *t)
+{
+	return t->t_cpu != curcpu->c_self && thread_cpu_ok(t, t->t_cpu);
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too. 
+ * targetcpu might be curcpu; it might not be, too. If it's not, the
+ * thread goes in its inbox.
  */
 static
 void
@@ -438,32 +1076,51 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	struct cpu *targetcpu;
 	bool isidle;
 
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
+	if (!already_have_lock && thread_wake_remote(target)) {
+		thread_updatepri(target);
+		thread_inbox_push(target->t_cpu, target, target);
+		return;
+	}
 
+	/* Lock the run queue of the target thread's cpu. */
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
+		targetcpu = target->t_cpu;
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
 	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		targetcpu = thread_runqueue_lock(target);
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
-	if (isidle) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
-	}
+	thread_updatepri(target);
+	thread_runqueue_insert(targetcpu, target);
+	thread_runqueue_notify(targetcpu, isidle);
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
+/*
+ * Requeue the thread thread_switch evicted from this cpu, now that
+ * we're off its stack. thread_make_runnable sends it somewhere it's
+ * allowed to run.
+ */
+static
+void
+evict(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_evicted;
+	if (t != NULL) {
+		curcpu->c_evicted = NULL;
+		KASSERT(t != curthread);
+		thread_make_runnable(t, false);
+	}
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -487,16 +1144,20 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	/* Recycle a dead thread and its stack if we can */
+	newthread = thread_pool_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -507,6 +1168,16 @@ thread_fork(const char *name,
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
 
+	/*
+	 * Scheduler fields. Inheriting the cpu usage means a thread
+	 * can't dodge its usage history by forking.
+	 */
+	newthread->t_nice = curthread->t_nice;
+	newthread->t_cpuusage = curthread->t_cpuusage;
+	newthread->t_schedepoch = curthread->t_schedepoch;
+	newthread->t_affinity = curthread->t_affinity;
+	newthread->t_pset = curthread->t_pset;
+
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
 		proc = curthread->t_proc;
@@ -534,6 +1205,123 @@ thread_fork(const char *name,
 	return 0;
 }
 
+/*
+ * Resource accounting.
+ *
+ * Time is measured with gettime_fast(), which is cheap enough to call
+ * on every trap. The running thread's time since t_usagestamp hasn't
+ * been charged to anything yet; whoever moves the thread between user
+ * mode, kernel mode and being switched out charges it to the right
+ * place and restarts the clock. Charging and restarting happen
+ * together, with interrupts off, so an interrupt that charges in
+ * between can't count the same time twice.
+ */
+static
+uint64_t
+thread_usage_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime_fast(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Time since the stamp, restarting the clock. Interrupts must be off.
+ * (Cpus' clocks can disagree slightly, so after migrating the stamp
+ * may be a little in the future.)
+ */
+static
+uint64_t
+thread_usage_elapsed(struct thread *cur, uint64_t now)
+{
+	uint64_t then;
+
+	then = cur->t_usagestamp;
+	cur->t_usagestamp = now;
+	return now > then ? now - then : 0;
+}
+
+void
+thread_usage_charge(bool user)
+{
+	struct thread *cur = curthread;
+	uint64_t now;
+	int spl;
+
+	spl = splhigh();
+	now = thread_usage_now();
+	seqlock_write_begin(&cur->t_usagelock);
+	if (user) {
+		cur->t_usage.u_utime += thread_usage_elapsed(cur, now);
+	}
+	else {
+		cur->t_usage.u_stime += thread_usage_elapsed(cur, now);
+	}
+	seqlock_write_end(&cur->t_usagelock);
+	splx(spl);
+}
+
+void
+thread_usage_count(unsigned faults, size_t inbytes, size_t outbytes)
+{
+	struct thread *cur = curthread;
+
+	seqlock_write_begin(&cur->t_usagelock);
+	cur->t_usage.u_minflt += faults;
+	cur->t_usage.u_inbytes += inbytes;
+	cur->t_usage.u_outbytes += outbytes;
+	seqlock_write_end(&cur->t_usagelock);
+}
+
+/*
+ * Called by thread_switch on the way out. Going to sleep is a
+ * voluntary switch; being put back on the run queue (by a yield,
+ * usually the timer's) is not.
+ */
+static
+void
+thread_usage_switch(struct thread *cur, threadstate_t newstate)
+{
+	uint64_t now;
+
+	/* thread_switch has interrupts off already. */
+	now = thread_usage_now();
+	seqlock_write_begin(&cur->t_usagelock);
+	cur->t_usage.u_stime += thread_usage_elapsed(cur, now);
+	if (newstate == S_SLEEP) {
+		cur->t_usage.u_nvcsw++;
+	}
+	else if (newstate == S_READY) {
+		cur->t_usage.u_nivcsw++;
+	}
+	seqlock_write_end(&cur->t_usagelock);
+}
+
+void
+thread_getusage(struct thread *t, struct usage *u)
+{
+	unsigned seq;
+
+	do {
+		seq = seqlock_read_begin(&t->t_usagelock);
+		*u = t->t_usage;
+	} while (seqlock_read_retry(&t->t_usagelock, seq));
+}
+
+void
+usage_add(struct usage *to, const struct usage *from)
+{
+	to->u_utime += from->u_utime;
+	to->u_stime += from->u_stime;
+	to->u_minflt += from->u_minflt;
+	to->u_nvcsw += from->u_nvcsw;
+	to->u_nivcsw += from->u_nivcsw;
+	to->u_inbytes += from->u_inbytes;
+	to->u_outbytes += from->u_outbytes;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -570,22 +1358,49 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
-	/* Lock the run queue. */
+	/* Lock the run queue, and pick up remote wakeups. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_inbox_drain();
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. Not if we
+	 * aren't allowed on this cpu any more, though; then we switch
+	 * to the evictor, below. Nor if we are the evictor, which idles
+	 * instead.
+	 */
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    thread_cpu_ok(cur, curcpu->c_self) && cur != curcpu->c_evictor) {
+		/* Nobody to preempt for, so no need for the timer */
+		thread_hardclock_update();
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/* Charge our time so far, and count the switch. */
+	thread_usage_switch(cur, newstate);
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (cur == curcpu->c_evictor) {
+			/* Parked until needed; see cpu_evictor. */
+		}
+		else if (thread_cpu_ok(cur, curcpu->c_self)) {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
+		else {
+			/*
+			 * We aren't allowed here any more. We'll
+			 * switch to some other thread (the evictor,
+			 * if there's nobody else), which then requeues
+			 * us elsewhere; see evict().
+			 */
+			KASSERT(curcpu->c_evicted == NULL);
+			curcpu->c_evicted = cur;
+		}
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
@@ -629,17 +1444,45 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
-	/* The current cpu is now idle. */
-	curcpu->c_isidle = true;
-	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
-		if (next == NULL) {
-			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
-			spinlock_acquire(&curcpu->c_runqueue_lock);
-		}
-	} while (next == NULL);
-	curcpu->c_isidle = false;
+	/*
+	 * If our own run queue is empty, try to steal a thread from
+	 * another CPU before idling. This has to be done without our
+	 * run queue lock held; see thread_steal. Because we're idle
+	 * while we don't hold the lock, anyone who queues a thread
+	 * for us will send IPI_UNIDLE, which brings us back here to
+	 * look again; so does the timer interrupt, if it's running.
+	 *
+	 * With options tickless, the timer is switched off while we
+	 * idle, and afterwards left on only if there's another
+	 * thread waiting that we might need to preempt for.
+	 */
+
+	if (curcpu->c_evicted == cur &&
+	    threadlist_isempty(&curcpu->c_runqueue)) {
+		/* We can't idle on the stack of a thread that's moving. */
+		next = curcpu->c_evictor;
+	}
+	else {
+		/* The current cpu is now idle. */
+		curcpu->c_isidle = true;
+		do {
+			thread_inbox_drain();
+			next = threadlist_remhead(&curcpu->c_runqueue);
+			if (next == NULL) {
+				hardclock_stop();
+				spinlock_release(&curcpu->c_runqueue_lock);
+				qsbr_quiescent();
+				next = thread_steal();
+				if (next == NULL) {
+					cpu_idle();
+				}
+				spinlock_acquire(&curcpu->c_runqueue_lock);
+			}
+		} while (next == NULL);
+		curcpu->c_isidle = false;
+	}
+
+	thread_hardclock_update();
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -705,6 +1548,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Time switched out isn't ours; restart the clock. */
+	cur->t_usagestamp = thread_usage_now();
+
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -714,6 +1560,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send away anyone who can't stay here. */
+	evict();
+
+	/* A context switch is a quiescent state. */
+	qsbr_quiescent();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -738,6 +1590,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Start the accounting clock (see thread_switch). */
+	cur->t_usagestamp = thread_usage_now();
+
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -747,6 +1602,12 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send away anyone who can't stay here. */
+	evict();
+
+	/* A context switch is a quiescent state. */
+	qsbr_quiescent();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -824,137 +1685,231 @@ thread_yield(void)
  *
  * This is called periodically from hardclock(). It should reshuffle
  * the current CPU's run queue by job priority.
+ *
+ * This is a multilevel feedback queue in the style of 4.4BSD: the
+ * run queue is kept sorted by priority (see thread_runqueue_insert),
+ * a thread's priority gets worse as hardclock() charges it cpu
+ * usage, and the usage decays once a second. Here we recompute the
+ * priorities of the threads waiting on this cpu, so threads that
+ * have been waiting a long time float back up, and re-sort. We
+ * also check the running process against its cpu time limit.
  */
-
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct threadlist old, evicted;
+	struct thread *t;
+
+#if OPT_TICKLESS
+	/* The timerclock isn't running to do this for us */
+	schedcpu();
+#endif
+
+	threadlist_init(&old);
+	threadlist_init(&evicted);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_inbox_drain();
+	while ((t = threadlist_remhead(&curcpu->c_runqueue)) != NULL) {
+		threadlist_addtail(&old, t);
+	}
+	while ((t = threadlist_remhead(&old)) != NULL) {
+		/*
+		 * While we're at it, pick out threads that are no
+		 * longer allowed on this cpu.
+		 */
+		if (!thread_cpu_ok(t, curcpu->c_self) &&
+		    t != curcpu->c_curthread) {
+			threadlist_addtail(&evicted, t);
+			continue;
+		}
+		thread_updatepri(t);
+		thread_runqueue_insert(curcpu->c_self, t);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	while ((t = threadlist_remhead(&evicted)) != NULL) {
+		thread_make_runnable(t, false);
+	}
+
+	threadlist_cleanup(&old);
+	threadlist_cleanup(&evicted);
+
+#if OPT_A2
+	/* Hold whatever we interrupted to its cpu time limit. */
+	if (curthread->t_proc != NULL) {
+		proc_checkcpulimit(curthread->t_proc);
+	}
+#endif
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Bring the scheduler epoch up to date with the time of day, which
+ * causes everyone's cpu usage to be halved, once per second elapsed,
+ * the next time their priority is recomputed. Using the clock rather
+ * than a counter means nothing is lost if this isn't called for a
+ * while, as happens when running tickless.
  */
 void
-thread_consider_migration(void)
+schedcpu(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime_fast(&secs, &nsecs);
+	sched_epoch = (unsigned)secs;
+}
+
+/*
+ * Nice value access, for getpriority/setpriority.
+ */
+int
+thread_getnice(struct thread *t)
+{
+	return t->t_nice;
+}
+
+void
+thread_setnice(struct thread *t, int nice)
+{
+	if (nice < PRIO_MIN) {
+		nice = PRIO_MIN;
+	}
+	if (nice > PRIO_MAX) {
+		nice = PRIO_MAX;
+	}
+	t->t_nice = nice;
+}
+
+/*
+ * Priority inheritance. Threads asleep or running elsewhere pick up
+ * the new value when they're next queued (though a boost is applied
+ * to t_priority right away, so it shows). A thread sitting in a run
+ * queue has to be moved, or it would wait its turn at the old
+ * priority. (A thread in transit through a cpu's inbox waits until
+ * the next schedule(), which recomputes everyone.)
+ */
+void
+thread_setinheritpri(struct thread *t, int pri)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
 	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct thread *t2;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
+	if (t == curthread) {
+		t->t_inheritpri = pri;
+		thread_updatepri(t);
+		return;
+	}
+
+	/* Lock T's cpu's run queue; T might be stolen meanwhile. */
+	while (1) {
+		c = t->t_cpu;
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+		if (t->t_cpu == c) {
+			break;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	t->t_inheritpri = pri;
+	if (pri < t->t_priority) {
+		t->t_priority = pri;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	THREADLIST_FORALL(t2, c->c_runqueue) {
+		if (t2 == t) {
+			threadlist_remove(&c->c_runqueue, t);
+			thread_updatepri(t);
+			thread_runqueue_insert(c, t);
+			break;
+		}
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+	spinlock_release(&c->c_runqueue_lock);
+}
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
-		spinlock_release(&c->c_runqueue_lock);
+/*
+ * Affinity and processor set access. If the current thread is no
+ * longer allowed where it is, yield so it can be moved; for other
+ * threads that happens the next time they're queued or switch.
+ */
+int
+thread_setaffinity(struct thread *t, cpumask_t mask)
+{
+	if ((mask & pset_cpus[t->t_pset]) == 0) {
+		return EINVAL;
+	}
+	t->t_affinity = mask;
+	if (t == curthread && !thread_cpu_ok(t, curcpu->c_self)) {
+		thread_yield();
 	}
+	return 0;
+}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+cpumask_t
+thread_getaffinity(struct thread *t)
+{
+	return t->t_affinity;
+}
+
+int
+thread_setpset(struct thread *t, unsigned pset)
+{
+	if (pset >= PSET_MAX || (t->t_affinity & pset_cpus[pset]) == 0) {
+		return EINVAL;
+	}
+	t->t_pset = pset;
+	if (t == curthread && !thread_cpu_ok(t, curcpu->c_self)) {
+		thread_yield();
+	}
+	return 0;
+}
+
+unsigned
+thread_getpset(struct thread *t)
+{
+	return t->t_pset;
+}
+
+/*
+ * Move a cpu to another processor set. Threads that aren't allowed
+ * on it any more are moved off as it reschedules.
+ */
+int
+pset_assign(unsigned pset, unsigned cpunum)
+{
+	cpumask_t bit;
+	unsigned i;
+
+	if (pset >= PSET_MAX || cpunum >= cpuarray_num(&allcpus)) {
+		return EINVAL;
+	}
+	bit = CPUMASK_BIT(cpunum);
+
+	spinlock_acquire(&pset_lock);
+	if (pset != PSET_DEFAULT && pset_cpus[PSET_DEFAULT] == bit) {
+		spinlock_release(&pset_lock);
+		return EBUSY;
+	}
+	/* Add to the new set first, so it's never in no set at all. */
+	pset_cpus[pset] |= bit;
+	for (i=0; i<PSET_MAX; i++) {
+		if (i != pset) {
+			pset_cpus[i] &= ~bit;
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
+	spinlock_release(&pset_lock);
+
+	return 0;
+}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+cpumask_t
+pset_getcpus(unsigned pset)
+{
+	if (pset >= PSET_MAX) {
+		return 0;
+	}
+	return pset_cpus[pset];
 }
 
 ////////////////////////////////////////////////////////////
@@ -1059,8 +2014,10 @@ wchan_wakeone(struct wchan *wc)
 void
 wchan_wakeall(struct wchan *wc)
 {
-	struct thread *target;
-	struct threadlist list;
+	struct thread *target, *first, *last;
+	struct threadlist list, rest;
+	struct cpu *targetcpu;
+	bool isidle;
 
 	threadlist_init(&list);
 
@@ -1079,12 +2036,64 @@ wchan_wakeall(struct wchan *wc)
 	spinlock_release(&wc->wc_lock);
 
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Make them runnable a cpu at a time: lock the run queue the
+	 * first thread on the list is going to, then queue everyone
+	 * else on the list who's going to the same place, so each
+	 * cpu's run queue is locked once and gets at most one IPI.
+	 * Threads going to another cpu's inbox are gathered the same
+	 * way and pushed with one compare-and-swap.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+		if (thread_wake_remote(target)) {
+			targetcpu = target->t_cpu;
+			first = last = target;
+			thread_updatepri(target);
+
+			threadlist_init(&rest);
+			while ((target = threadlist_remhead(&list)) != NULL) {
+				if (target->t_cpu == targetcpu &&
+				    thread_cpu_ok(target, targetcpu)) {
+					thread_updatepri(target);
+					last->t_inboxnext = target;
+					last = target;
+				}
+				else {
+					threadlist_addtail(&rest, target);
+				}
+			}
+			while ((target = threadlist_remhead(&rest)) != NULL) {
+				threadlist_addtail(&list, target);
+			}
+			threadlist_cleanup(&rest);
+
+			thread_inbox_push(targetcpu, first, last);
+			continue;
+		}
+
+		targetcpu = thread_runqueue_lock(target);
+		isidle = targetcpu->c_isidle;
+		thread_updatepri(target);
+		thread_runqueue_insert(targetcpu, target);
+
+		threadlist_init(&rest);
+		while ((target = threadlist_remhead(&list)) != NULL) {
+			if (target->t_cpu == targetcpu &&
+			    (thread_cpu_ok(target, targetcpu) ||
+			     targetcpu->c_curthread == target)) {
+				thread_updatepri(target);
+				thread_runqueue_insert(targetcpu, target);
+			}
+			else {
+				threadlist_addtail(&rest, target);
+			}
+		}
+		while ((target = threadlist_remhead(&rest)) != NULL) {
+			threadlist_addtail(&list, target);
+		}
+		threadlist_cleanup(&rest);
+
+		thread_runqueue_notify(targetcpu, isidle);
+		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
 
 	threadlist_cleanup(&list);
@@ -1106,6 +2115,52 @@ wchan_isempty(struct wchan *wc)
 	return ret;
 }
 
+/*
+ * Timeout callback for thread_sleep_until: wake the sleeper.
+ */
+static
+void
+thread_sleep_timeout(void *vwc)
+{
+	wchan_wakeone(vwc);
+}
+
+/*
+ * Sleep until time of day WHEN (as returned by gettime()).
+ *
+ * The wait channel lives on our stack, since nobody but the timeout
+ * can find it. The timeout is set with the channel locked, and goes
+ * off on this cpu, so it can't try to wake us before we're asleep;
+ * and wchan_wakeone doesn't touch the channel after unlocking it, so
+ * it's safe to let it go out of scope as soon as we're awake.
+ */
+void
+thread_sleep_until(const struct timespec *when)
+{
+	struct wchan wc;
+	struct timeout to;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+
+	wc.wc_name = "sleep";
+	threadlist_init(&wc.wc_threads);
+	spinlock_init(&wc.wc_lock);
+	timeout_init(&to, thread_sleep_timeout, &wc);
+
+	wchan_lock(&wc);
+	if (timeout_set(&to, when)) {
+		wchan_sleep(&wc);
+	}
+	else {
+		/* Already past. */
+		wchan_unlock(&wc);
+	}
+
+	spinlock_cleanup(&wc.wc_lock);
+	threadlist_cleanup(&wc.wc_threads);
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -1189,8 +2244,11 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_UNIDLE)) {
 		/*
 		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
+		 * interrupt. If it was running tickless, it may also
+		 * need its timer back; if not, thread_switch will
+		 * turn it off again.
 		 */
+		hardclock_start();
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
@@ -1206,4 +2264,12 @@ interprocessor_interrupt(void)
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	/*
+	 * Any interrupt is a quiescent state, since read sections run
+	 * with interrupts off; IPI_QSBR exists just to get us here.
+	 * This has to wait until c_ipi_lock is released, because
+	 * qsbr_quiescent may send IPIs itself.
+	 */
+	qsbr_quiescent();
 }
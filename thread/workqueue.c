@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Work queues. See workqueue.h.
+ *
+ * Each queue is a FIFO of items under a spinlock, plus a wait channel
+ * for idle workers. An item's state is protected by the lock of the
+ * queue it's going on (wk_wq), which is fixed when it's queued: a
+ * delayed item goes on the queue of the cpu whose timer wheel its
+ * timeout is on, and timeouts run on the cpu that set them.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spl.h>
+#include <thread.h>
+#include <current.h>
+#include <wchan.h>
+#include <workqueue.h>
+
+struct workq {
+	struct spinlock wq_lock;
+	struct work *wq_head;		/* Pending items, oldest first */
+	struct work **wq_tail;
+	struct wchan *wq_wchan;		/* Idle workers sleep here */
+	unsigned wq_cpu;		/* Cpu number we run on */
+	unsigned wq_nworkers;		/* Workers started */
+	unsigned wq_idle;		/* Workers asleep on wq_wchan */
+};
+
+static struct workq workqs[CPUMASK_MAXCPUS];
+static bool workq_started;
+
+static void workq_worker(void *data1, unsigned long data2);
+
+/*
+ * Start another worker for WQ. Whoever calls this has already
+ * counted it in wq_nworkers.
+ */
+static
+void
+workq_addworker(struct workq *wq)
+{
+	char name[16];
+	int result;
+
+	snprintf(name, sizeof(name), "worker/%u", wq->wq_cpu);
+	result = thread_fork(name, NULL, workq_worker, wq, 0);
+	if (result) {
+		kprintf("workqueue: cpu%u: thread_fork: %s\n",
+			wq->wq_cpu, strerror(result));
+		spinlock_acquire(&wq->wq_lock);
+		wq->wq_nworkers--;
+		spinlock_release(&wq->wq_lock);
+	}
+}
+
+/*
+ * Start up: one queue and one worker per cpu. All cpus are in the
+ * default processor set at boot, so that tells us which ones there
+ * are. Call after the secondary cpus are started.
+ */
+void
+workqueue_bootstrap(void)
+{
+	cpumask_t cpus;
+	struct workq *wq;
+	unsigned i;
+
+	cpus = pset_getcpus(PSET_DEFAULT);
+	for (i=0; i<CPUMASK_MAXCPUS; i++) {
+		if ((cpus & CPUMASK_BIT(i)) == 0) {
+			continue;
+		}
+		wq = &workqs[i];
+		spinlock_init(&wq->wq_lock);
+		wq->wq_head = NULL;
+		wq->wq_tail = &wq->wq_head;
+		wq->wq_wchan = wchan_create("workq");
+		if (wq->wq_wchan == NULL) {
+			panic("workqueue_bootstrap: Out of memory\n");
+		}
+		wq->wq_cpu = i;
+		wq->wq_nworkers = 1;
+		wq->wq_idle = 0;
+	}
+	workq_started = true;
+
+	for (i=0; i<CPUMASK_MAXCPUS; i++) {
+		if (cpus & CPUMASK_BIT(i)) {
+			workq_addworker(&workqs[i]);
+		}
+	}
+}
+
+/*
+ * Worker thread. Bind to our cpu, then run items as they arrive.
+ */
+static
+void
+workq_worker(void *data1, unsigned long data2)
+{
+	struct workq *wq = data1;
+	struct work *wk;
+	bool grow;
+
+	(void)data2;
+
+	/* Can fail if the cpu has left the default set; run anyway. */
+	thread_setaffinity(curthread, CPUMASK_BIT(wq->wq_cpu));
+
+	spinlock_acquire(&wq->wq_lock);
+	while (1) {
+		while (wq->wq_head == NULL) {
+			wq->wq_idle++;
+			wchan_lock(wq->wq_wchan);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(wq->wq_wchan);
+			spinlock_acquire(&wq->wq_lock);
+			wq->wq_idle--;
+		}
+
+		wk = wq->wq_head;
+		wq->wq_head = wk->wk_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tail = &wq->wq_head;
+		}
+		wk->wk_next = NULL;
+		KASSERT(wk->wk_state == WORK_QUEUED);
+		wk->wk_state = WORK_IDLE;
+
+		/*
+		 * If there's a backlog and nobody else to take it,
+		 * start another worker before getting busy.
+		 */
+		grow = wq->wq_head != NULL && wq->wq_idle == 0 &&
+			wq->wq_nworkers < WORKQ_MAXWORKERS;
+		if (grow) {
+			wq->wq_nworkers++;
+		}
+		spinlock_release(&wq->wq_lock);
+
+		if (grow) {
+			workq_addworker(wq);
+		}
+		wk->wk_func(wk->wk_data1, wk->wk_data2);
+
+		spinlock_acquire(&wq->wq_lock);
+	}
+}
+
+/*
+ * Put WK on its queue and get a worker going. Call with the queue
+ * locked.
+ */
+static
+void
+workq_append(struct workq *wq, struct work *wk)
+{
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+
+	wk->wk_state = WORK_QUEUED;
+	wk->wk_next = NULL;
+	*wq->wq_tail = wk;
+	wq->wq_tail = &wk->wk_next;
+	if (wq->wq_idle > 0) {
+		wchan_wakeone(wq->wq_wchan);
+	}
+}
+
+/*
+ * Timeout callback for delayed items.
+ */
+static
+void
+work_timeout(void *data)
+{
+	struct work *wk = data;
+	struct workq *wq = wk->wk_wq;
+
+	spinlock_acquire(&wq->wq_lock);
+	/* Unless work_cancel got here first */
+	if (wk->wk_state == WORK_DELAYED) {
+		workq_append(wq, wk);
+	}
+	spinlock_release(&wq->wq_lock);
+}
+
+void
+work_init(struct work *wk, void (*func)(void *, unsigned long),
+	  void *data1, unsigned long data2)
+{
+	wk->wk_next = NULL;
+	wk->wk_wq = NULL;
+	wk->wk_state = WORK_IDLE;
+	timeout_init(&wk->wk_timeout, work_timeout, wk);
+	wk->wk_func = func;
+	wk->wk_data1 = data1;
+	wk->wk_data2 = data2;
+}
+
+/*
+ * Lock and return the current cpu's queue. Holding the spinlock keeps
+ * us on this cpu until it's released.
+ */
+static
+struct workq *
+workq_lockcur(void)
+{
+	struct workq *wq;
+	int spl;
+
+	KASSERT(workq_started);
+
+	spl = splhigh();
+	wq = &workqs[curcpu->c_number];
+	spinlock_acquire(&wq->wq_lock);
+	splx(spl);
+	return wq;
+}
+
+bool
+work_queue(struct work *wk)
+{
+	struct workq *wq;
+
+	wq = workq_lockcur();
+	if (wk->wk_state != WORK_IDLE) {
+		spinlock_release(&wq->wq_lock);
+		return false;
+	}
+	wk->wk_wq = wq;
+	workq_append(wq, wk);
+	spinlock_release(&wq->wq_lock);
+	return true;
+}
+
+bool
+work_queue_delayed(struct work *wk, const struct timespec *delay)
+{
+	struct workq *wq;
+	struct timespec when;
+	uint32_t nsecs;
+
+	gettime(&when.tv_sec, &nsecs);
+	when.tv_sec += delay->tv_sec;
+	when.tv_nsec = nsecs + delay->tv_nsec;
+	if (when.tv_nsec >= 1000000000) {
+		when.tv_nsec -= 1000000000;
+		when.tv_sec++;
+	}
+
+	wq = workq_lockcur();
+	if (wk->wk_state != WORK_IDLE) {
+		spinlock_release(&wq->wq_lock);
+		return false;
+	}
+	wk->wk_wq = wq;
+	wk->wk_state = WORK_DELAYED;
+	if (!timeout_set(&wk->wk_timeout, &when)) {
+		/* Already due */
+		workq_append(wq, wk);
+	}
+	spinlock_release(&wq->wq_lock);
+	return true;
+}
+
+bool
+work_cancel(struct work *wk)
+{
+	struct workq *wq = wk->wk_wq;
+	struct work **wkp;
+	bool wasqueued = false;
+
+	if (wq == NULL) {
+		/* Never queued */
+		return false;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	switch (wk->wk_state) {
+	    case WORK_DELAYED:
+		/*
+		 * If the timeout has already gone off, work_timeout
+		 * sees the state change and drops the item.
+		 */
+		timeout_cancel(&wk->wk_timeout);
+		wk->wk_state = WORK_IDLE;
+		wasqueued = true;
+		break;
+	    case WORK_QUEUED:
+		for (wkp = &wq->wq_head; *wkp != wk; wkp = &(*wkp)->wk_next) {
+			KASSERT(*wkp != NULL);
+		}
+		*wkp = wk->wk_next;
+		if (wq->wq_tail == &wk->wk_next) {
+			wq->wq_tail = wkp;
+		}
+		wk->wk_next = NULL;
+		wk->wk_state = WORK_IDLE;
+		wasqueued = true;
+		break;
+	}
+	spinlock_release(&wq->wq_lock);
+	return wasqueued;
+}
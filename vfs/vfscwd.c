@@ -44,21 +44,32 @@
 
 /*
  * Get current directory as a vnode.
+ *
+ * This doesn't take p_lock. The reference count is protected by the
+ * vfs big lock, which VOP_INCREF has to take anyway (and which may
+ * sleep, so it can't be taken under p_lock) and which the lookup
+ * code calling us already holds. Holding the big lock
+ * across both fetching p_cwd and increfing it is enough: a setter
+ * swaps the pointer first and only then drops its reference, which
+ * needs the big lock too, so the vnode we find can't go away before
+ * we've added ours.
  */
 int
 vfs_getcurdir(struct vnode **ret)
 {
+	struct vnode *cwd;
 	int rv = 0;
 
-	spinlock_acquire(&curproc->p_lock);
-	if (curproc->p_cwd!=NULL) {
-		VOP_INCREF(curproc->p_cwd);
-		*ret = curproc->p_cwd;
+	vfs_biglock_acquire();
+	cwd = curproc->p_cwd;
+	if (cwd!=NULL) {
+		VOP_INCREF(cwd);
+		*ret = cwd;
 	}
 	else {
 		rv = ENOENT;
 	}
-	spinlock_release(&curproc->p_lock);
+	vfs_biglock_release();
 
 	return rv;
 }
@@ -36,6 +36,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
 #include <lib.h>
 #include <array.h>
 #include <synch.h>
@@ -43,6 +44,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <workqueue.h>
 
 /*
  * Structure for a single named device.
@@ -169,6 +171,92 @@ vfs_sync(void)
 	return 0;
 }
 
+/*
+ * Periodic write-back. The syncer is a work item that syncs all the
+ * filesystems and requeues itself, so dirty data doesn't sit in
+ * memory indefinitely. It runs on a workqueue thread, where it may
+ * sleep on the big lock and on disk I/O.
+ *
+ * vfs_syncer_lock covers the flags, so the syncer's check of
+ * vfs_syncer_on and its requeue can't straddle vfs_syncer_stop.
+ */
+#define VFS_SYNCER_SECS 30
+
+static struct work vfs_syncer;
+static struct lock *vfs_syncer_lock;
+static struct cv *vfs_syncer_cv;	/* vfs_syncer_running went false */
+static bool vfs_syncer_on;
+static bool vfs_syncer_running;
+
+static
+void
+vfs_syncer_run(void *data1, unsigned long data2)
+{
+	struct timespec delay;
+
+	(void)data1;
+	(void)data2;
+
+	lock_acquire(vfs_syncer_lock);
+	if (!vfs_syncer_on) {
+		/* Stopped after the worker took us off the queue */
+		lock_release(vfs_syncer_lock);
+		return;
+	}
+	vfs_syncer_running = true;
+	lock_release(vfs_syncer_lock);
+
+	vfs_sync();
+
+	lock_acquire(vfs_syncer_lock);
+	vfs_syncer_running = false;
+	cv_broadcast(vfs_syncer_cv, vfs_syncer_lock);
+	if (vfs_syncer_on) {
+		delay.tv_sec = VFS_SYNCER_SECS;
+		delay.tv_nsec = 0;
+		work_queue_delayed(&vfs_syncer, &delay);
+	}
+	lock_release(vfs_syncer_lock);
+}
+
+void
+vfs_syncer_start(void)
+{
+	struct timespec delay;
+
+	vfs_syncer_lock = lock_create("vfs_syncer");
+	vfs_syncer_cv = cv_create("vfs_syncer");
+	if (vfs_syncer_lock == NULL || vfs_syncer_cv == NULL) {
+		panic("vfs_syncer_start: Out of memory\n");
+	}
+	work_init(&vfs_syncer, vfs_syncer_run, NULL, 0);
+
+	lock_acquire(vfs_syncer_lock);
+	vfs_syncer_on = true;
+	vfs_syncer_running = false;
+	delay.tv_sec = VFS_SYNCER_SECS;
+	delay.tv_nsec = 0;
+	work_queue_delayed(&vfs_syncer, &delay);
+	lock_release(vfs_syncer_lock);
+}
+
+/*
+ * Stop the syncer. If it's in the middle of running, wait for it to
+ * finish; either way it's not queued and won't queue itself again
+ * once this returns.
+ */
+void
+vfs_syncer_stop(void)
+{
+	lock_acquire(vfs_syncer_lock);
+	vfs_syncer_on = false;
+	work_cancel(&vfs_syncer);
+	while (vfs_syncer_running) {
+		cv_wait(vfs_syncer_cv, vfs_syncer_lock);
+	}
+	lock_release(vfs_syncer_lock);
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.